@@ -0,0 +1,377 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* Measures the speed of every compression format, and of the code file parser,
+   so that performance work on p2bin can be measured. Everything goes through
+   the library's public API, so the numbers include the same overhead that a
+   real conversion has. */
+
+/* P2BIN_PTHREADS is only defined on POSIX platforms. */
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+#include <sys/resource.h>
+#endif
+
+#include "file.h"
+#include "p2bin.h"
+#include "timer.h"
+
+/* Each measurement is repeated until at least this much time has passed, to smooth out noise. */
+#define MINIMUM_MEASUREMENT_TIME 0.5
+
+typedef struct Payload
+{
+	const char *name;
+	unsigned char *data;
+	size_t size;
+} Payload;
+
+static void ErrorCallback(void* const user_data, const char* const message)
+{
+	(void)user_data;
+
+	fprintf(stderr, "Error: %s\n", message);
+}
+
+static double GetPeakMemoryUsage(void)
+{
+	/* Returns the peak memory usage of the whole process in MiB, or -1 if it is not known. */
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	#ifdef __APPLE__
+		return usage.ru_maxrss / (1024.0 * 1024.0);
+	#else
+		return usage.ru_maxrss / 1024.0;
+	#endif
+#endif
+
+	return -1.0;
+}
+
+static unsigned char* AppendSegment(unsigned char* const pointer, const unsigned int processor_family, const unsigned long start_address, const unsigned char* const data, const unsigned int length)
+{
+	/* Writes a segment record in the format that AS uses. */
+	unsigned char *output = pointer;
+	unsigned int i;
+
+	*output++ = 0x81;
+	*output++ = processor_family;
+	*output++ = 0; /* Segment. */
+	*output++ = 1; /* Granularity. */
+
+	for (i = 0; i < 4; ++i)
+		*output++ = (start_address >> (8 * i)) & 0xFF;
+
+	*output++ = (length >> (8 * 0)) & 0xFF;
+	*output++ = (length >> (8 * 1)) & 0xFF;
+
+	memcpy(output, data, length);
+
+	return output + length;
+}
+
+static unsigned char* AppendEnd(unsigned char* const pointer)
+{
+	static const char creator[] = "p2bin-bench";
+
+	*pointer = 0x00;
+	memcpy(pointer + 1, creator, sizeof(creator) - 1);
+
+	return pointer + 1 + sizeof(creator) - 1;
+}
+
+static unsigned char* MakeCodeFileForPayload(const Payload* const payload, size_t* const size)
+{
+	/* A 68000 segment, followed by the payload as a series of Z80 segments at address 0, followed by another 68000 segment. */
+	static const unsigned char vector[4] = {0, 0, 0, 0};
+	const size_t maximum_segment_length = 0xFFFF;
+	const size_t total_segments = payload->size / maximum_segment_length + 1;
+	unsigned char* const code_file = (unsigned char*)malloc(2 + (10 + sizeof(vector)) * 2 + 10 * total_segments + payload->size + 0x20);
+
+	if (code_file != NULL)
+	{
+		unsigned char *pointer = code_file;
+		size_t position = 0;
+
+		*pointer++ = 0x89;
+		*pointer++ = 0x14;
+
+		pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_68000, 0, vector, sizeof(vector));
+
+		do
+		{
+			const size_t length = payload->size - position < maximum_segment_length ? payload->size - position : maximum_segment_length;
+
+			pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_Z80, position, &payload->data[position], (unsigned int)length);
+			position += length;
+		} while (position != payload->size);
+
+		/* Allow for the payload growing by a lot when compressed, so that there is never a lack of space. */
+		pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_68000, 4 + payload->size * 2 + 0x100, vector, sizeof(vector));
+		pointer = AppendEnd(pointer);
+
+		*size = pointer - code_file;
+	}
+
+	return code_file;
+}
+
+static void BenchmarkCompression(const Payload* const payload, const P2Bin_Compression compression)
+{
+	size_t code_file_size;
+	unsigned char* const code_file = MakeCodeFileForPayload(payload, &code_file_size);
+
+	if (code_file == NULL)
+	{
+		fputs("Error: Out of memory.\n", stderr);
+	}
+	else
+	{
+		P2Bin_CompressedSegment compressed_segment;
+		P2Bin_Options options;
+		double total_time = 0.0;
+		unsigned long compressed_size = 0;
+		unsigned int iterations = 0;
+
+		memset(&compressed_segment, 0, sizeof(compressed_segment));
+		compressed_segment.processor_family = P2BIN_PROCESSOR_FAMILY_Z80;
+		compressed_segment.starting_address = 0;
+		compressed_segment.compression = compression;
+		compressed_segment.constant = "Benchmark";
+		compressed_segment.type = P2BIN_TYPE_AFTER;
+
+		memset(&options, 0, sizeof(options));
+		options.compressed_segments = &compressed_segment;
+		options.total_compressed_segments = 1;
+		options.error_callback = ErrorCallback;
+
+		do
+		{
+			P2Bin_Result result;
+
+			if (!P2Bin_Convert(code_file, code_file_size, &options, &result))
+				break;
+
+			/* Not the conversion's 'compression_time', as that leaves out the compression that overlaps parsing. */
+			total_time += result.compressed_groups[0].compression_time;
+			compressed_size = result.compressed_groups[0].size;
+			++iterations;
+
+			P2Bin_FreeResult(&result);
+		} while (total_time < MINIMUM_MEASUREMENT_TIME);
+
+		if (iterations != 0)
+		{
+			const double seconds_per_iteration = total_time / iterations;
+
+			printf("%-24.24s %-26s %10lu %10lu %7.3f %10.3f %9.1f\n",
+				payload->name,
+				P2Bin_compression_names[compression],
+				(unsigned long)payload->size,
+				compressed_size,
+				payload->size == 0 ? 0.0 : (double)compressed_size / payload->size,
+				seconds_per_iteration == 0.0 ? 0.0 : payload->size / seconds_per_iteration / (1024.0 * 1024.0),
+				GetPeakMemoryUsage());
+		}
+
+		free(code_file);
+	}
+}
+
+static void BenchmarkParser(const unsigned long total_segments)
+{
+	/* Lots of tiny segments, like the ones that a big disassembly produces, with the occasional gap for padding. */
+	unsigned char* const code_file = (unsigned char*)malloc(2 + total_segments * (10 + 0x20) + 0x20);
+
+	if (code_file == NULL)
+	{
+		fputs("Error: Out of memory.\n", stderr);
+	}
+	else
+	{
+		unsigned char data[0x20];
+		unsigned char *pointer = code_file;
+		unsigned long address = 0, random = 1;
+		unsigned long i;
+		P2Bin_Options options;
+		double total_time = 0.0;
+		unsigned int iterations = 0;
+		size_t code_file_size;
+
+		for (i = 0; i < sizeof(data); ++i)
+			data[i] = (unsigned char)i;
+
+		*pointer++ = 0x89;
+		*pointer++ = 0x14;
+
+		for (i = 0; i < total_segments; ++i)
+		{
+			unsigned int length;
+
+			/* A simple linear congruential generator, so that the results are the same on every platform. */
+			random = (random * 1103515245 + 12345) & 0x7FFFFFFF;
+			length = 1 + (random >> 16) % sizeof(data);
+
+			pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_68000, address, data, length);
+			address += length + (i % 8 == 0 ? (random >> 8) % 0x40 : 0);
+		}
+
+		pointer = AppendEnd(pointer);
+		code_file_size = pointer - code_file;
+
+		memset(&options, 0, sizeof(options));
+		options.error_callback = ErrorCallback;
+
+		do
+		{
+			P2Bin_Result result;
+
+			if (!P2Bin_Convert(code_file, code_file_size, &options, &result))
+				break;
+
+			total_time += result.statistics.parse_time;
+			++iterations;
+
+			P2Bin_FreeResult(&result);
+		} while (total_time < MINIMUM_MEASUREMENT_TIME);
+
+		if (iterations != 0)
+		{
+			const double seconds_per_iteration = total_time / iterations;
+
+			printf("%10lu segments, %10lu bytes: %12.0f segments/s %10.3f MiB/s %9.1f\n",
+				total_segments,
+				(unsigned long)code_file_size,
+				seconds_per_iteration == 0.0 ? 0.0 : total_segments / seconds_per_iteration,
+				seconds_per_iteration == 0.0 ? 0.0 : code_file_size / seconds_per_iteration / (1024.0 * 1024.0),
+				GetPeakMemoryUsage());
+		}
+
+		free(code_file);
+	}
+}
+
+static int MakeSyntheticPayloads(Payload* const payloads)
+{
+	/* Data that is easy, typical, and impossible to compress. */
+	const size_t size = 0x2000;
+	unsigned long random = 1;
+	size_t i;
+
+	payloads[0].name = "synthetic-zeroes";
+	payloads[1].name = "synthetic-text";
+	payloads[2].name = "synthetic-random";
+
+	for (i = 0; i < 3; ++i)
+	{
+		payloads[i].size = size;
+		payloads[i].data = (unsigned char*)malloc(size);
+
+		if (payloads[i].data == NULL)
+			return 0;
+	}
+
+	memset(payloads[0].data, 0, size);
+
+	for (i = 0; i < size; ++i)
+	{
+		static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+
+		random = (random * 1103515245 + 12345) & 0x7FFFFFFF;
+
+		/* Repetitive data with the occasional corruption, similar to machine code. */
+		payloads[1].data[i] = (random >> 16) % 16 == 0 ? (unsigned char)(random >> 8) : (unsigned char)text[i % (sizeof(text) - 1)];
+		payloads[2].data[i] = (unsigned char)(random >> 16);
+	}
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int exit_code = EXIT_SUCCESS;
+	const size_t total_payloads = 3 + (argc - 1);
+	Payload* const payloads = (Payload*)calloc(total_payloads, sizeof(Payload));
+
+	if (payloads == NULL || !MakeSyntheticPayloads(payloads))
+	{
+		fputs("Error: Out of memory.\n", stderr);
+		exit_code = EXIT_FAILURE;
+	}
+	else
+	{
+		size_t i;
+		unsigned int compression;
+
+		/* Any files on the command line, such as real sound drivers, are used as extra payloads. */
+		for (i = 3; i < total_payloads; ++i)
+		{
+			FILE* const file = fopen(argv[i - 2], "rb");
+
+			payloads[i].name = argv[i - 2];
+
+			if (file == NULL)
+			{
+				fprintf(stderr, "Error: Could not open file '%s' for reading.\n", payloads[i].name);
+				exit_code = EXIT_FAILURE;
+			}
+			else
+			{
+				payloads[i].data = File_ReadWhole(file, &payloads[i].size);
+				fclose(file);
+
+				if (payloads[i].data == NULL)
+				{
+					fprintf(stderr, "Error: Could not read file '%s'.\n", payloads[i].name);
+					exit_code = EXIT_FAILURE;
+				}
+			}
+		}
+
+		if (exit_code == EXIT_SUCCESS)
+		{
+			puts("Compression:");
+			printf("%-24s %-26s %10s %10s %7s %10s %9s\n", "payload", "format", "size", "compressed", "ratio", "MiB/s", "peak MiB");
+
+			for (i = 0; i < total_payloads; ++i)
+				/* 'auto' only picks one of the others, so it is left out. */
+				for (compression = 0; compression < P2BIN_COMPRESSION_AUTO; ++compression)
+					BenchmarkCompression(&payloads[i], (P2Bin_Compression)compression);
+
+			puts("");
+			puts("Parser:");
+			BenchmarkParser(1000);
+			BenchmarkParser(100000);
+			BenchmarkParser(1000000);
+		}
+
+		for (i = 0; i < total_payloads; ++i)
+			free(payloads[i].data);
+	}
+
+	free(payloads);
+
+	return exit_code;
+}
@@ -0,0 +1,175 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* P2BIN_PTHREADS is only defined on POSIX platforms. */
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "file.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#endif
+
+#if defined(_WIN32) || defined(P2BIN_PTHREADS)
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+unsigned char* File_ReadWhole(FILE* const file, size_t* const size)
+{
+	unsigned char *buffer = NULL;
+	size_t capacity = 0;
+
+	*size = 0;
+
+	for (;;)
+	{
+		if (*size == capacity)
+		{
+			unsigned char* const new_buffer = (unsigned char*)realloc(buffer, capacity = capacity == 0 ? 0x10000 : capacity * 2);
+
+			if (new_buffer == NULL)
+			{
+				free(buffer);
+				return NULL;
+			}
+
+			buffer = new_buffer;
+		}
+
+		*size += fread(&buffer[*size], 1, capacity - *size, file);
+
+		if (*size != capacity)
+			break;
+	}
+
+	if (ferror(file))
+	{
+		free(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+int File_ReadContents(FILE* const file, File_Contents* const contents)
+{
+	unsigned char *data;
+
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+	struct stat status;
+
+	/* Only regular files can be mapped, and a mapping cannot be empty. */
+	if (fstat(fileno(file), &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0 && (off_t)(size_t)status.st_size == status.st_size)
+	{
+		void* const mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+
+		/* The mapping stays valid after the file is closed. */
+		if (mapping != MAP_FAILED)
+		{
+			contents->data = (const unsigned char*)mapping;
+			contents->size = status.st_size;
+			contents->mapped = 1;
+			return 1;
+		}
+	}
+#endif
+
+	/* Fall back on copying the file. */
+	data = File_ReadWhole(file, &contents->size);
+
+	contents->data = data;
+	contents->mapped = 0;
+
+	return data != NULL;
+}
+
+void File_FreeContents(File_Contents* const contents)
+{
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+	if (contents->mapped)
+	{
+		munmap((void*)contents->data, contents->size);
+		return;
+	}
+#endif
+
+	free((void*)contents->data);
+}
+
+int File_IsStandardStream(const char* const filename)
+{
+	return strcmp(filename, "-") == 0;
+}
+
+void File_SetBinaryMode(FILE* const file)
+{
+#ifdef _WIN32
+	_setmode(_fileno(file), _O_BINARY);
+#else
+	(void)file;
+#endif
+}
+
+int File_GetStamp(const char* const filename, File_Stamp* const stamp)
+{
+#if defined(_WIN32) || defined(P2BIN_PTHREADS)
+	struct stat status;
+
+	if (stat(filename, &status) != 0)
+		return 0;
+
+	stamp->modification_time = status.st_mtime;
+	stamp->size = status.st_size;
+
+	return 1;
+#else
+	(void)filename;
+	(void)stamp;
+
+	return 0;
+#endif
+}
+
+int File_StampsMatch(const File_Stamp* const a, const File_Stamp* const b)
+{
+	/* The modification time only has a resolution of a second, so the size is checked too. */
+	return a->modification_time == b->modification_time && a->size == b->size;
+}
+
+unsigned long File_GetProcessID(void)
+{
+#if defined(_WIN32)
+	return _getpid();
+#elif defined(P2BIN_PTHREADS)
+	return getpid();
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef FILE_H
+#define FILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Identifies a version of a file, so that changes to it can be noticed. */
+typedef struct File_Stamp
+{
+	time_t modification_time;
+	unsigned long size;
+} File_Stamp;
+
+/* The whole of a file in memory, which may be mapped instead of copied. */
+typedef struct File_Contents
+{
+	const unsigned char *data;
+	size_t size;
+	int mapped;
+} File_Contents;
+
+/* Reads the remainder of 'file' into a newly-allocated buffer, which must be
+   freed with 'free'. Returns NULL on failure. This avoids relying on 'fseek'
+   and 'ftell', so that it works with any kind of stream. */
+unsigned char* File_ReadWhole(FILE *file, size_t *size);
+
+/* Like 'File_ReadWhole', but where the platform allows it, a regular file is
+   mapped into memory instead, so that its data is not copied through an
+   intermediate buffer. 'file' must be at its start, and may be closed
+   afterwards. The file must not be truncated until the contents are released
+   with 'File_FreeContents'. Returns non-zero on success. */
+int File_ReadContents(FILE *file, File_Contents *contents);
+
+void File_FreeContents(File_Contents *contents);
+
+/* Returns whether 'filename' is '-', which stands for standard input or
+   standard output. */
+int File_IsStandardStream(const char *filename);
+
+/* Stops the platform from translating line endings in 'file', which is needed
+   for binary data to pass through 'stdin' and 'stdout' intact on Windows. */
+void File_SetBinaryMode(FILE *file);
+
+/* Returns non-zero on success. This fails if the file does not exist, or if
+   the platform has no way to find out when a file was modified. */
+int File_GetStamp(const char *filename, File_Stamp *stamp);
+
+/* Returns an identifier for the current process, for naming temporary files
+   that other processes must not write to at the same time. Returns 0 if the
+   platform cannot tell one process from another. */
+unsigned long File_GetProcessID(void);
+
+/* Returns whether two stamps are of the same version of a file. */
+int File_StampsMatch(const File_Stamp *a, const File_Stamp *b);
+
+#endif /* FILE_H */
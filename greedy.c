@@ -0,0 +1,310 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "greedy.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Longer chains find better matches, but take longer to search. */
+#define MAXIMUM_CHAIN_LENGTH 0x40
+
+#define NO_POSITION ((size_t)-1)
+
+/* Every position in the data is linked to the previous position that starts
+   with the same bytes, so that candidate matches can be found without
+   searching the whole window. */
+typedef struct MatchFinder
+{
+	const unsigned char *data;
+	size_t size;
+	size_t key_length;
+	size_t heads[0x10000];
+	size_t *previous;
+} MatchFinder;
+
+static unsigned int GetKey(const MatchFinder* const finder, const size_t position)
+{
+	const unsigned char* const bytes = &finder->data[position];
+
+	/* Two-byte keys are exact. Three-byte keys are hashed, so matches are checked in full anyway. */
+	if (finder->key_length == 2)
+		return bytes[0] << 8 | bytes[1];
+	else
+		return ((bytes[0] << 8 | bytes[1]) ^ (bytes[2] << 5)) & 0xFFFF;
+}
+
+static MatchFinder* MatchFinder_Create(const unsigned char* const data, const size_t size, const size_t key_length)
+{
+	MatchFinder* const finder = (MatchFinder*)malloc(sizeof(MatchFinder));
+
+	if (finder != NULL)
+	{
+		finder->data = data;
+		finder->size = size;
+		finder->key_length = key_length;
+		finder->previous = (size_t*)malloc(sizeof(size_t) * (size + 1));
+
+		if (finder->previous == NULL)
+		{
+			free(finder);
+			return NULL;
+		}
+
+		/* Every byte of 'NO_POSITION' is 0xFF. */
+		memset(finder->heads, 0xFF, sizeof(finder->heads));
+	}
+
+	return finder;
+}
+
+static void MatchFinder_Destroy(MatchFinder* const finder)
+{
+	free(finder->previous);
+	free(finder);
+}
+
+static void MatchFinder_Insert(MatchFinder* const finder, const size_t position)
+{
+	if (finder->size - position >= finder->key_length)
+	{
+		size_t* const head = &finder->heads[GetKey(finder, position)];
+
+		finder->previous[position] = *head;
+		*head = position;
+	}
+}
+
+static size_t MatchFinder_Find(const MatchFinder* const finder, const size_t position, const size_t maximum_distance, const size_t maximum_length, size_t* const distance)
+{
+	/* Returns the length of the longest match, preferring the nearest one. 'position' must not have been inserted yet. */
+	const size_t length_limit = finder->size - position < maximum_length ? finder->size - position : maximum_length;
+	size_t best_length = 0;
+	size_t candidate;
+	unsigned int chain_length;
+
+	if (length_limit < finder->key_length)
+		return 0;
+
+	candidate = finder->heads[GetKey(finder, position)];
+
+	for (chain_length = 0; candidate != NO_POSITION && position - candidate <= maximum_distance && chain_length < MAXIMUM_CHAIN_LENGTH; ++chain_length)
+	{
+		size_t length = 0;
+
+		while (length < length_limit && finder->data[candidate + length] == finder->data[position + length])
+			++length;
+
+		if (length > best_length)
+		{
+			best_length = length;
+			*distance = position - candidate;
+
+			if (length == length_limit)
+				break;
+		}
+
+		candidate = finder->previous[candidate];
+	}
+
+	return best_length < finder->key_length ? 0 : best_length;
+}
+
+/* Kosinski */
+
+typedef struct KosinskiWriter
+{
+	void (*write)(void *user_data, const unsigned char *bytes, size_t total_bytes);
+	void *user_data;
+	unsigned int descriptor;
+	unsigned int descriptor_bits;
+	/* The descriptor is written to the first two bytes when it is full. Up to 17 matches of 3 bytes can follow it,
+	   as the bytes of the match that fills a descriptor come after the next one. */
+	unsigned char block[2 + 17 * 3];
+	size_t block_size;
+} KosinskiWriter;
+
+static void KosinskiWriter_Flush(KosinskiWriter* const writer)
+{
+	writer->block[0] = writer->descriptor & 0xFF;
+	writer->block[1] = writer->descriptor >> 8 & 0xFF;
+	writer->write(writer->user_data, writer->block, writer->block_size);
+
+	writer->descriptor = 0;
+	writer->descriptor_bits = 0;
+	writer->block_size = 2;
+}
+
+static void KosinskiWriter_PutBit(KosinskiWriter* const writer, const unsigned int bit)
+{
+	writer->descriptor |= bit << writer->descriptor_bits;
+
+	/* The decompressor reads the next descriptor as soon as this one runs out, so it must come before the remainder of this match. */
+	if (++writer->descriptor_bits == 16)
+		KosinskiWriter_Flush(writer);
+}
+
+static void KosinskiWriter_PutByte(KosinskiWriter* const writer, const unsigned int byte)
+{
+	writer->block[writer->block_size++] = byte & 0xFF;
+}
+
+int Greedy_KosinskiCompress(const unsigned char* const data, const size_t size, void (* const write)(void *user_data, const unsigned char *bytes, size_t total_bytes), void* const user_data)
+{
+	MatchFinder* const finder = MatchFinder_Create(data, size, 2);
+	KosinskiWriter writer;
+	size_t position;
+
+	if (finder == NULL)
+		return 0;
+
+	writer.write = write;
+	writer.user_data = user_data;
+	writer.descriptor = 0;
+	writer.descriptor_bits = 0;
+	writer.block_size = 2;
+
+	position = 0;
+
+	while (position < size)
+	{
+		size_t distance = 0;
+		size_t length = MatchFinder_Find(finder, position, 0x2000, 0x100, &distance);
+		size_t i;
+
+		/* Only the short form can encode a match of two bytes. */
+		if (length == 2 && distance > 0x100)
+			length = 0;
+
+		if (length == 0)
+		{
+			KosinskiWriter_PutBit(&writer, 1);
+			KosinskiWriter_PutByte(&writer, data[position]);
+			length = 1;
+		}
+		else if (length <= 5 && distance <= 0x100)
+		{
+			/* Inline match. */
+			KosinskiWriter_PutBit(&writer, 0);
+			KosinskiWriter_PutBit(&writer, 0);
+			KosinskiWriter_PutBit(&writer, (length - 2) >> 1);
+			KosinskiWriter_PutBit(&writer, (length - 2) & 1);
+			KosinskiWriter_PutByte(&writer, 0x100 - distance);
+		}
+		else
+		{
+			/* Full match, with the count in a third byte if it is too large for three bits. */
+			const unsigned int offset = 0x2000 - distance;
+
+			KosinskiWriter_PutBit(&writer, 0);
+			KosinskiWriter_PutBit(&writer, 1);
+			KosinskiWriter_PutByte(&writer, offset & 0xFF);
+
+			if (length <= 9)
+			{
+				KosinskiWriter_PutByte(&writer, (offset >> 5 & 0xF8) | (length - 2));
+			}
+			else
+			{
+				KosinskiWriter_PutByte(&writer, offset >> 5 & 0xF8);
+				KosinskiWriter_PutByte(&writer, length - 1);
+			}
+		}
+
+		for (i = 0; i < length; ++i)
+			MatchFinder_Insert(finder, position + i);
+
+		position += length;
+	}
+
+	/* The end of the data is marked by a full match with a count of 0. */
+	KosinskiWriter_PutBit(&writer, 0);
+	KosinskiWriter_PutBit(&writer, 1);
+	KosinskiWriter_PutByte(&writer, 0x00);
+	KosinskiWriter_PutByte(&writer, 0xF0);
+	KosinskiWriter_PutByte(&writer, 0x00);
+	KosinskiWriter_Flush(&writer);
+
+	MatchFinder_Destroy(finder);
+
+	return 1;
+}
+
+/* Saxman */
+
+int Greedy_SaxmanCompress(const unsigned char* const data, const size_t size, void (* const write)(void *user_data, const unsigned char *bytes, size_t total_bytes), void* const user_data)
+{
+	MatchFinder* const finder = MatchFinder_Create(data, size, 3);
+	/* A flag byte, followed by up to eight literals or matches. */
+	unsigned char block[1 + 8 * 2];
+	size_t block_size;
+	unsigned int total_flags;
+	size_t position;
+
+	if (finder == NULL)
+		return 0;
+
+	block[0] = 0;
+	block_size = 1;
+	total_flags = 0;
+
+	position = 0;
+
+	while (position < size)
+	{
+		size_t distance = 0;
+		/* The window is kept to the size of the original compressor's, which does not reuse the
+		   part of its ring buffer that holds the data that is yet to be compressed. */
+		size_t length = MatchFinder_Find(finder, position, 0x1000 - 0x12, 0x12, &distance);
+		size_t i;
+
+		if (length == 0)
+		{
+			block[0] |= 1 << total_flags;
+			block[block_size++] = data[position];
+			length = 1;
+		}
+		else
+		{
+			/* Matches refer to a position in the decompressor's ring buffer, which starts at 0xFEE. */
+			const unsigned int ring_position = (position - distance + 0xFEE) & 0xFFF;
+
+			block[block_size++] = ring_position & 0xFF;
+			block[block_size++] = (ring_position >> 4 & 0xF0) | (length - 3);
+		}
+
+		for (i = 0; i < length; ++i)
+			MatchFinder_Insert(finder, position + i);
+
+		position += length;
+
+		if (++total_flags == 8)
+		{
+			write(user_data, block, block_size);
+
+			block[0] = 0;
+			block_size = 1;
+			total_flags = 0;
+		}
+	}
+
+	if (total_flags != 0)
+		write(user_data, block, block_size);
+
+	MatchFinder_Destroy(finder);
+
+	return 1;
+}
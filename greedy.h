@@ -0,0 +1,34 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* Greedy LZSS compressors for the fast ':fast' formats. They are much faster
+   than the optimised compressors and, unlike the authentic ones, they have no
+   global state, so any number of them can run at once. The data that they
+   produce is larger, but decompresses the same. */
+
+#ifndef GREEDY_H
+#define GREEDY_H
+
+#include <stddef.h>
+
+/* Compresses 'data' in the Kosinski format, passing the output to 'write' a
+   block at a time. The output is not padded. Returns 0 if out of memory. */
+int Greedy_KosinskiCompress(const unsigned char *data, size_t size, void (*write)(void *user_data, const unsigned char *bytes, size_t total_bytes), void *user_data);
+
+/* Compresses 'data' in the Saxman format, without the size header, passing the
+   output to 'write' a block at a time. Returns 0 if out of memory. */
+int Greedy_SaxmanCompress(const unsigned char *data, size_t size, void (*write)(void *user_data, const unsigned char *bytes, size_t total_bytes), void *user_data);
+
+#endif /* GREEDY_H */
@@ -16,6 +16,16 @@
 ***************************************************************
 	Modified by Clownacy on 2023/05/28 to integrate with
 	the newer 'p2bin' tool.
+***************************************************************
+	Modified to add a faster string comparison to the
+	match finder, which produces identical output to the
+	original. The original is kept for verification.
+***************************************************************
+	Modified to keep all state in a caller-provided struct,
+	so that multiple encodes can run at once.
+***************************************************************
+	Modified to read the text from memory and write the code
+	a unit at a time, instead of calling back for every byte.
 **************************************************************/
 #include "LZSS.h"
 
@@ -30,19 +40,11 @@
 						   if match_length is greater than this */
 #define NIL			N	/* index for root of binary search trees */
 
-static unsigned long int
-		textsize = 0,	/* text size counter */
-		codesize = 0,	/* code size counter */
-		printcount = 0;	/* counter for reporting progress every 1K bytes */
-static unsigned char
-		text_buf[N + F - 1];	/* ring buffer of size N,
-			with extra F-1 bytes to facilitate string comparison */
-static int		match_position, match_length,  /* of longest match.  These are
-			set by the InsertNode() procedure. */
-		lson[N + 1], rson[N + 257], dad[N + 1];  /* left & right children &
-			parents -- These constitute binary search trees. */
-
-static void InitTree(void)  /* initialize trees */
+#if N != LZSS_N || F != LZSS_F
+#error "LZSS.h and LZSS.c disagree on the buffer sizes"
+#endif
+
+static void InitTree(LZSS_State *state)  /* initialize trees */
 {
 	int  i;
 
@@ -54,14 +56,36 @@ static void InitTree(void)  /* initialize trees */
 	   for strings that begin with character i.  These are initialized
 	   to NIL.  Note there are 256 trees. */
 
-	for (i = N + 1; i <= N + 256; i++) rson[i] = NIL;
-	for (i = 0; i < N; i++) dad[i] = NIL;
+	for (i = N + 1; i <= N + 256; i++) state->rson[i] = NIL;
+	for (i = 0; i < N; i++) state->dad[i] = NIL;
 }
 
-static void InsertNode(int r)
+static int CompareStrings(const unsigned char *key, const unsigned char *other, int *cmp)
+	/* Returns the length of the common prefix of the strings key[0..F-1] and
+	   other[0..F-1], whose first characters are already known to match, and
+	   sets cmp to the difference between the first mismatching characters.
+	   This produces exactly the same results as the original loop, so the
+	   shape of the trees, and thus the output, is unaffected. */
+{
+	int  i;
+	unsigned long  a, b;
+
+	/* Compare a word at a time until a word differs, and then find the
+	   differing character within it, so that each character is only looked
+	   at once.  'memcpy' is used as the strings are not aligned. */
+	for (i = 1; i + (int)sizeof(a) <= F; i += sizeof(a)) {
+		memcpy(&a, &key[i], sizeof(a));  memcpy(&b, &other[i], sizeof(b));
+		if (a != b)  break;
+	}
+	for ( ; i < F; i++)
+		if ((*cmp = key[i] - other[i]) != 0)  return i;
+	*cmp = 0;  return F;
+}
+
+static void InsertNode(LZSS_State *state, int r)
 	/* Inserts string of length F, text_buf[r..r+F-1], into one of the
 	   trees (text_buf[r]'th tree) and returns the longest-match position
-	   and length via the global variables match_position and match_length.
+	   and length via state->match_position and state->match_length.
 	   If match_length = F, then removes the old node in favor of the new
 	   one, because the old one will be deleted sooner.
 	   Note r plays double role, as tree node and position in buffer. */
@@ -69,151 +93,229 @@ static void InsertNode(int r)
 	int  i, p, cmp;
 	unsigned char  *key;
 
-	cmp = 1;  key = &text_buf[r];  p = N + 1 + key[0];
-	rson[r] = lson[r] = NIL;  match_length = 0;
+	cmp = 1;  key = &state->text_buf[r];  p = N + 1 + key[0];
+	state->rson[r] = state->lson[r] = NIL;  state->match_length = 0;
 	for ( ; ; ) {
 		if (cmp >= 0) {
-			if (rson[p] != NIL) p = rson[p];
-			else {  rson[p] = r;  dad[r] = p;  return;  }
+			if (state->rson[p] != NIL) p = state->rson[p];
+			else {  state->rson[p] = r;  state->dad[r] = p;  return;  }
 		} else {
-			if (lson[p] != NIL) p = lson[p];
-			else {  lson[p] = r;  dad[r] = p;  return;  }
+			if (state->lson[p] != NIL) p = state->lson[p];
+			else {  state->lson[p] = r;  state->dad[r] = p;  return;  }
 		}
-		for (i = 1; i < F; i++)
-			if ((cmp = key[i] - text_buf[p + i]) != 0)  break;
-		if (i > match_length) {
-			match_position = p;
-			if ((match_length = i) >= F)  break;
+		if (state->use_reference_compare) {
+			for (i = 1; i < F; i++)
+				if ((cmp = key[i] - state->text_buf[p + i]) != 0)  break;
+		} else {
+			i = CompareStrings(key, &state->text_buf[p], &cmp);
+		}
+		if (i > state->match_length) {
+			state->match_position = p;
+			if ((state->match_length = i) >= F)  break;
 		}
 	}
-	dad[r] = dad[p];  lson[r] = lson[p];  rson[r] = rson[p];
-	dad[lson[p]] = r;  dad[rson[p]] = r;
-	if (rson[dad[p]] == p) rson[dad[p]] = r;
-	else                   lson[dad[p]] = r;
-	dad[p] = NIL;  /* remove p */
+	state->dad[r] = state->dad[p];  state->lson[r] = state->lson[p];  state->rson[r] = state->rson[p];
+	state->dad[state->lson[p]] = r;  state->dad[state->rson[p]] = r;
+	if (state->rson[state->dad[p]] == p) state->rson[state->dad[p]] = r;
+	else                   state->lson[state->dad[p]] = r;
+	state->dad[p] = NIL;  /* remove p */
 }
 
-static void DeleteNode(int p)  /* deletes node p from tree */
+static void DeleteNode(LZSS_State *state, int p)  /* deletes node p from tree */
 {
 	int  q;
 	
-	if (dad[p] == NIL) return;  /* not in tree */
-	if (rson[p] == NIL) q = lson[p];
-	else if (lson[p] == NIL) q = rson[p];
+	if (state->dad[p] == NIL) return;  /* not in tree */
+	if (state->rson[p] == NIL) q = state->lson[p];
+	else if (state->lson[p] == NIL) q = state->rson[p];
 	else {
-		q = lson[p];
-		if (rson[q] != NIL) {
-			do {  q = rson[q];  } while (rson[q] != NIL);
-			rson[dad[q]] = lson[q];  dad[lson[q]] = dad[q];
-			lson[q] = lson[p];  dad[lson[p]] = q;
+		q = state->lson[p];
+		if (state->rson[q] != NIL) {
+			do {  q = state->rson[q];  } while (state->rson[q] != NIL);
+			state->rson[state->dad[q]] = state->lson[q];  state->dad[state->lson[q]] = state->dad[q];
+			state->lson[q] = state->lson[p];  state->dad[state->lson[p]] = q;
 		}
-		rson[q] = rson[p];  dad[rson[p]] = q;
+		state->rson[q] = state->rson[p];  state->dad[state->rson[p]] = q;
 	}
-	dad[q] = dad[p];
-	if (rson[dad[p]] == p) rson[dad[p]] = q;  else lson[dad[p]] = q;
-	dad[p] = NIL;
+	state->dad[q] = state->dad[p];
+	if (state->rson[state->dad[p]] == p) state->rson[state->dad[p]] = q;  else state->lson[state->dad[p]] = q;
+	state->dad[p] = NIL;
 }
 
-void Encode(int (*read_callback)(void *user_data), const void *user_data, FILE *outfile)
+static void EncodeWithCompare(LZSS_State *state, const unsigned char *data, size_t size, void (*write_callback)(void *user_data, const unsigned char *bytes, size_t total_bytes), const void *write_user_data, int reference_compare)
 {
 	int  i, c, len, r, s, last_match_length, code_buf_ptr;
 	unsigned char  code_buf[17], mask;
+	size_t  data_pos = 0;
 	
-	InitTree();  /* initialize trees */
+	state->use_reference_compare = reference_compare;
+	state->codesize = state->printcount = 0;
+	InitTree(state);  /* initialize trees */
 	code_buf[0] = 0;  /* code_buf[1..16] saves eight units of code, and
 		code_buf[0] works as eight flags, "1" representing that the unit
 		is an unencoded letter (1 byte), "0" a position-and-length pair
 		(2 bytes).  Thus, eight units require at most 16 bytes of code. */
 	code_buf_ptr = mask = 1;
 	s = 0;  r = N - F;
-	for (i = s; i < r; i++) text_buf[i] = 0;  /* Clear the buffer with
-		any character that will appear often. */
-	for (len = 0; len < F && (c = read_callback((void*)user_data)) != EOF; len++)
-		text_buf[r + len] = c;  /* Read F bytes into the last F bytes of
+	memset(state->text_buf, 0, sizeof(state->text_buf));  /* Clear the buffer with
+		any character that will appear often.  All of it is cleared, not
+		just text_buf[s..r-1], because texts shorter than F are compared
+		against the rest of it, which used to be zero as a static. */
+	for (len = 0; len < F && data_pos < size; len++)
+		state->text_buf[r + len] = data[data_pos++];  /* Read F bytes into the last F bytes of
 			the buffer */
-	if ((textsize = len) == 0) return;  /* text of size zero */
-	for (i = 1; i <= F; i++) InsertNode(r - i);  /* Insert the F strings,
+	if ((state->textsize = len) == 0) return;  /* text of size zero */
+	for (i = 1; i <= F; i++) InsertNode(state, r - i);  /* Insert the F strings,
 		each of which begins with one or more 'space' characters.  Note
 		the order in which these strings are inserted.  This way,
 		degenerate trees will be less likely to occur. */
-	InsertNode(r);  /* Finally, insert the whole string just read.  The
-		global variables match_length and match_position are set. */
+	InsertNode(state, r);  /* Finally, insert the whole string just read.  The
+		match_length and match_position in the state are set. */
 	do {
-		if (match_length > len) match_length = len;  /* match_length
+		if (state->match_length > len) state->match_length = len;  /* match_length
 			may be spuriously long near the end of text. */
-		if (match_length <= THRESHOLD) {
-			match_length = 1;  /* Not long enough match.  Send one byte. */
+		if (state->match_length <= THRESHOLD) {
+			state->match_length = 1;  /* Not long enough match.  Send one byte. */
 			code_buf[0] |= mask;  /* 'send one byte' flag */
-			code_buf[code_buf_ptr++] = text_buf[r];  /* Send uncoded. */
+			code_buf[code_buf_ptr++] = state->text_buf[r];  /* Send uncoded. */
 		} else {
-			code_buf[code_buf_ptr++] = (unsigned char) match_position;
+			code_buf[code_buf_ptr++] = (unsigned char) state->match_position;
 			code_buf[code_buf_ptr++] = (unsigned char)
-				(((match_position >> 4) & 0xf0)
-			  | (match_length - (THRESHOLD + 1)));  /* Send position and
+				(((state->match_position >> 4) & 0xf0)
+			  | (state->match_length - (THRESHOLD + 1)));  /* Send position and
 					length pair. Note match_length > THRESHOLD. */
 		}
 		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
-			for (i = 0; i < code_buf_ptr; i++)  /* Send at most 8 units of */
-				putc(code_buf[i], outfile);     /* code together */
-			codesize += code_buf_ptr;
+			write_callback((void*)write_user_data, code_buf, code_buf_ptr);  /* Send at most 8 units of
+				code together */
+			state->codesize += code_buf_ptr;
 			code_buf[0] = 0;  code_buf_ptr = mask = 1;
 		}
-		last_match_length = match_length;
-		for (i = 0; i < last_match_length &&
-				(c = read_callback((void*)user_data)) != EOF; i++) {
-			DeleteNode(s);		/* Delete old strings and */
-			text_buf[s] = c;	/* read new bytes */
-			if (s < F - 1) text_buf[s + N] = c;  /* If the position is
+		last_match_length = state->match_length;
+		for (i = 0; i < last_match_length && data_pos < size; i++) {
+			c = data[data_pos++];
+			DeleteNode(state, s);		/* Delete old strings and */
+			state->text_buf[s] = c;	/* read new bytes */
+			if (s < F - 1) state->text_buf[s + N] = c;  /* If the position is
 				near the end of buffer, extend the buffer to make
 				string comparison easier. */
 			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
 				/* Since this is a ring buffer, increment the position
 				   modulo N. */
-			InsertNode(r);	/* Register the string in text_buf[r..r+F-1] */
+			InsertNode(state, r);	/* Register the string in text_buf[r..r+F-1] */
 		}
-		if ((textsize += i) > printcount) {
+		if ((state->textsize += i) > state->printcount) {
 			/*printf("%12ld\r", textsize);  printcount += 1024;*/
 				/* Reports progress each time the textsize exceeds
 				   multiples of 1024. */
 		}
 		while (i++ < last_match_length) {	/* After the end of text, */
-			DeleteNode(s);					/* no need to read, but */
+			DeleteNode(state, s);					/* no need to read, but */
 			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
-			if (--len) InsertNode(r);		/* buffer may not be empty. */
+			if (--len) InsertNode(state, r);		/* buffer may not be empty. */
 		}
 	} while (len > 0);	/* until length of string to be processed is zero */
 	if (code_buf_ptr > 1) {		/* Send remaining code. */
-		for (i = 0; i < code_buf_ptr; i++) putc(code_buf[i], outfile);
-		codesize += code_buf_ptr;
+		write_callback((void*)write_user_data, code_buf, code_buf_ptr);
+		state->codesize += code_buf_ptr;
 	}
 	/*printf("In : %ld bytes\n", textsize);*/	/* Encoding is done. */
 	/*printf("Out: %ld bytes\n", codesize);*/
 	/*printf("Out/In: %.3f\n", (double)codesize / textsize);*/
 }
 
-void Decode(int (*read_callback)(void *user_data), const void *user_data, FILE *outfile)	/* Just the reverse of Encode(). */
+void LZSS_Encode(LZSS_State *state, const unsigned char *data, size_t size, void (*write_callback)(void *user_data, const unsigned char *bytes, size_t total_bytes), const void *write_user_data)
+{
+	EncodeWithCompare(state, data, size, write_callback, write_user_data, 0);
+}
+
+void LZSS_EncodeReference(LZSS_State *state, const unsigned char *data, size_t size, void (*write_callback)(void *user_data, const unsigned char *bytes, size_t total_bytes), const void *write_user_data)
+	/* Encodes using the original string comparison. The output is identical
+	   to LZSS_Encode(), so this is only useful for verifying that. */
+{
+	EncodeWithCompare(state, data, size, write_callback, write_user_data, 1);
+}
+
+void LZSS_Decode(LZSS_State *state, int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data)	/* Just the reverse of Encode(). */
 {
 	int  i, j, k, r, c;
 	unsigned int  flags;
 	
-	for (i = 0; i < N - F; i++) text_buf[i] = 0;
+	memset(state->text_buf, 0, sizeof(state->text_buf));  /* See EncodeWithCompare(). */
 	r = N - F;  flags = 0;
 	for ( ; ; ) {
 		if (((flags >>= 1) & 256) == 0) {
-			if ((c = read_callback((void*)user_data)) == EOF) break;
+			if ((c = read_callback((void*)read_user_data)) == EOF) break;
 			flags = c | 0xff00;		/* uses higher byte cleverly */
 		}							/* to count eight */
 		if (flags & 1) {
-			if ((c = read_callback((void*)user_data)) == EOF) break;
-			putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+			if ((c = read_callback((void*)read_user_data)) == EOF) break;
+			write_callback((void*)write_user_data, c);  state->text_buf[r++] = c;  r &= (N - 1);
 		} else {
-			if ((i = read_callback((void*)user_data)) == EOF) break;
-			if ((j = read_callback((void*)user_data)) == EOF) break;
+			if ((i = read_callback((void*)read_user_data)) == EOF) break;
+			if ((j = read_callback((void*)read_user_data)) == EOF) break;
 			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
 			for (k = 0; k <= j; k++) {
-				c = text_buf[(i + k) & (N - 1)];
-				putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+				c = state->text_buf[(i + k) & (N - 1)];
+				write_callback((void*)write_user_data, c);  state->text_buf[r++] = c;  r &= (N - 1);
+			}
+		}
+	}
+}
+
+/* These use a single, shared state, so they are not reentrant. */
+
+static LZSS_State shared_state;
+
+typedef struct ByteWriter
+{
+	void (*write_callback)(void *user_data, int byte);
+	const void *write_user_data;
+} ByteWriter;
+
+static void WriteBytes(void *user_data, const unsigned char *bytes, size_t total_bytes)
+{
+	const ByteWriter *writer = (const ByteWriter*)user_data;
+	size_t  i;
+
+	for (i = 0; i < total_bytes; i++) writer->write_callback((void*)writer->write_user_data, bytes[i]);
+}
+
+static void EncodeFromCallbacks(int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data, int reference_compare)
+	/* The whole text is read into memory first, as the encoder needs it
+	   there.  Nothing is written if it does not fit. */
+{
+	unsigned char  *data = NULL, *new_data;
+	size_t  size = 0, capacity = 0;
+	ByteWriter  writer;
+	int  c;
+
+	while ((c = read_callback((void*)read_user_data)) != EOF) {
+		if (size == capacity) {
+			capacity = capacity == 0 ? 0x1000 : capacity * 2;
+			if ((new_data = (unsigned char*)realloc(data, capacity)) == NULL) {
+				free(data);  return;
 			}
+			data = new_data;
 		}
+		data[size++] = c;
 	}
+	writer.write_callback = write_callback;  writer.write_user_data = write_user_data;
+	EncodeWithCompare(&shared_state, data, size, WriteBytes, &writer, reference_compare);
+	free(data);
+}
+
+void Encode(int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data)
+{
+	EncodeFromCallbacks(read_callback, read_user_data, write_callback, write_user_data, 0);
+}
+
+void EncodeReference(int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data)
+{
+	EncodeFromCallbacks(read_callback, read_user_data, write_callback, write_user_data, 1);
+}
+
+void Decode(int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data)
+{
+	LZSS_Decode(&shared_state, read_callback, read_user_data, write_callback, write_user_data);
 }
@@ -1,9 +1,37 @@
 #ifndef LZSS_H
 #define LZSS_H
 
-#include <stdio.h>
+#include <stddef.h>
 
-void Encode(int (*read_callback)(void *user_data), const void *user_data, FILE *outfile);
-void Decode(int (*read_callback)(void *user_data), const void *user_data, FILE *outfile);
+#define LZSS_N 4096	/* size of ring buffer */
+#define LZSS_F   18	/* upper limit for match_length */
+
+typedef struct LZSS_State
+{
+	unsigned long int
+		textsize,	/* text size counter */
+		codesize,	/* code size counter */
+		printcount;	/* counter for reporting progress every 1K bytes */
+	unsigned char
+		text_buf[LZSS_N + LZSS_F - 1];	/* ring buffer of size N,
+			with extra F-1 bytes to facilitate string comparison */
+	int		match_position, match_length,  /* of longest match.  These are
+			set by the InsertNode() procedure. */
+		lson[LZSS_N + 1], rson[LZSS_N + 257], dad[LZSS_N + 1];  /* left & right children &
+			parents -- These constitute binary search trees. */
+	int		use_reference_compare;	/* use the original string comparison */
+} LZSS_State;
+
+/* Reentrant versions, which keep their state in the provided struct. The
+   encoders read the whole text from memory, and write the code a unit (a flag
+   byte and up to eight literals or matches) at a time. */
+void LZSS_Encode(LZSS_State *state, const unsigned char *data, size_t size, void (*write_callback)(void *user_data, const unsigned char *bytes, size_t total_bytes), const void *write_user_data);
+void LZSS_EncodeReference(LZSS_State *state, const unsigned char *data, size_t size, void (*write_callback)(void *user_data, const unsigned char *bytes, size_t total_bytes), const void *write_user_data);
+void LZSS_Decode(LZSS_State *state, int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data);
+
+/* Non-reentrant versions, which share a single internal state. */
+void Encode(int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data);
+void EncodeReference(int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data);
+void Decode(int (*read_callback)(void *user_data), const void *read_user_data, void (*write_callback)(void *user_data, int byte), const void *write_user_data);
 
 #endif /* LZSS_H */
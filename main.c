@@ -13,637 +13,1586 @@ OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 PERFORMANCE OF THIS SOFTWARE.
 */
 
-/* Documentation of AS's code file format can be found here:
-   http://john.ccac.rwth-aachen.de:8000/as/as_EN.html#sect_5_1_ */
-
-/* Terminology in this code reflects the above documentation. */
-
-#include <setjmp.h>
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "accurate-kosinski/lib/kosinski-compress.h"
-#include "clownlzss/kosinski.h"
-#include "clownlzss/kosinskiplus.h"
-#include "clownlzss/saxman.h"
-#include "lz_comp2/LZSS.h"
+#include "file.h"
+#include "p2bin.h"
+#include "thread.h"
+#include "timer.h"
 
-typedef enum Compression
+typedef struct Job
 {
-	COMPRESSION_UNCOMPRESSED,
-	COMPRESSION_KOSINSKI,
-	COMPRESSION_KOSINSKI_OPTIMISED,
-	COMPRESSION_SAXMAN,
-	COMPRESSION_SAXMAN_BUGGED,
-	COMPRESSION_SAXMAN_OPTIMISED,
-	COMPRESSION_KOSINSKIPLUS
-} Compression;
-
-typedef enum Type
+	const char *input_filename, *output_filename, *header_filename;
+	const char *statistics_filename;
+	const char *patch_filename;
+	/* In planning mode, the size needed by every compressed group is written here instead of building a ROM. */
+	const char *plan_filename;
+	int incremental;
+	int watch;
+	/* In watch mode, the ROM from the previous build is kept here, so that the output file does not need to be read back. */
+	unsigned char *previous_rom;
+	size_t previous_rom_size;
+	P2Bin_Options options;
+	P2Bin_CompressedSegment *compressed_segments;
+	size_t compressed_segments_capacity;
+	P2Bin_Fixup *fixups;
+	size_t fixups_capacity;
+	char **descriptor_files;
+	size_t total_descriptor_files;
+
+	/* Prefixed to error messages in batch mode, so that it is clear which conversion they belong to. */
+	const char *name;
+	int success;
+	unsigned long bytes_written;
+} Job;
+
+static void JobMessage(const Job* const job, const char* const prefix, const char* const format, va_list args)
 {
-	TYPE_BEFORE, /* S&K */
-	TYPE_AFTER   /* S1, S2 */
-} Type;
+	/* Build the whole message first, so that messages from different threads do not get mixed together. */
+	char message[0x400];
+	int length;
 
-typedef struct CompressedSegment
-{
-	struct CompressedSegment *next;
+	length = sprintf(message, "%s", prefix);
 
-	unsigned long starting_address;
-	Compression compression;
-	const char *constant;
-	Type type;
-} CompressedSegment;
-
-static const char *header_filename;
-static FILE *input_file, *output_file;
-static jmp_buf jump_buffer;
-static unsigned char padding_buffer[0x1000];
-static unsigned char z80_buffer[0x2000];
-static unsigned int z80_read_index, z80_write_index;
-static unsigned long maximum_address = 0;
-static unsigned long last_z80_segment_end = -1;
-static unsigned int padding_value = 0;
-static unsigned long previous_68k_segment_start;
-static unsigned int previous_68k_segment_length;
-static CompressedSegment *compressed_segment_list_head = NULL;
-static const CompressedSegment *current_compressed_segment = NULL;
-
-static unsigned int ReadByte(void)
-{
-	const int byte = fgetc(input_file);
+	if (job->name != NULL)
+		length += sprintf(&message[length], "%.200s: ", job->name);
 
-	if (byte == EOF)
-	{
-		fputs("Error: File ended prematurely.\n", stderr);
-		longjmp(jump_buffer, 1);
-	}
+	/* ANSI C lacks 'vsnprintf', so arguments must be kept reasonably short. */
+	length += vsprintf(&message[length], format, args);
 
-	return (unsigned long)byte;
-}
+	message[length++] = '\n';
+	message[length] = '\0';
 
-static void ReadBytes(unsigned char* const buffer, const unsigned int total_bytes)
-{
-	if (fread(buffer, total_bytes, 1, input_file) == 0)
-	{
-		fputs("Error: File ended prematurely.\n", stderr);
-		longjmp(jump_buffer, 1);
-	}
+	fputs(message, stderr);
 }
 
-static unsigned long ReadInteger(const unsigned int total_bytes)
+static void JobError(const Job* const job, const char* const format, ...)
 {
-	unsigned long value;
-	unsigned int i;
-
-	value = 0;
+	va_list args;
 
-	for (i = 0; i < total_bytes; ++i)
-		value |= (unsigned long)ReadByte() << (i * 8);
-
-	return value;
+	va_start(args, format);
+	JobMessage(job, "Error: ", format, args);
+	va_end(args);
 }
 
-static unsigned int ReadWord(void)
+static void JobNote(const Job* const job, const char* const format, ...)
 {
-	return ReadInteger(2);
-}
+	va_list args;
 
-static unsigned long ReadLongInt(void)
-{
-	return ReadInteger(4);
+	va_start(args, format);
+	JobMessage(job, "Note: ", format, args);
+	va_end(args);
 }
 
-static unsigned int AccurateKosinskiCompressCallback_ReadByte(void* const user_data)
+static void ErrorCallback(void* const user_data, const char* const message)
 {
-	(void)user_data;
-
-	return z80_read_index == z80_write_index ? (unsigned int)-1 : z80_buffer[z80_read_index++];
+	JobError((const Job*)user_data, "%.300s", message);
 }
 
-static void AccurateKosinskiCompressCallback_WriteByte(void* const user_data, const unsigned int byte)
+static void InitialiseJob(Job* const job)
 {
-	(void)user_data;
-
-	fputc(byte, output_file);
+	memset(job, 0, sizeof(*job));
+	job->options.error_callback = ErrorCallback;
+	job->options.error_callback_user_data = job;
 }
 
-static void ClownLZSSCallback_Write(void* const user_data, const unsigned char byte)
+static void DeinitialiseJob(Job* const job)
 {
-	(void)user_data;
-
-	fputc(byte, output_file);
-}
+	size_t i;
 
-static void ClownLZSSCallback_Seek(void* const user_data, const size_t position)
-{
-	(void)user_data;
+	for (i = 0; i < job->total_descriptor_files; ++i)
+		free(job->descriptor_files[i]);
 
-	fseek(output_file, position, SEEK_SET);
+	free(job->descriptor_files);
+	free(job->compressed_segments);
+	free(job->fixups);
+	free(job->previous_rom);
 }
 
-static size_t ClownLZSSCallback_Tell(void* const user_data)
+static int ParseCompressedSegment(Job* const job, char* const descriptor, const char* const location)
 {
-	(void)user_data;
+	/* Parses a descriptor of the form '[address],[compression],[constant],[type]', optionally followed by ',[family]'.
+	   Returns 0 if the descriptor is malformed, leaving the caller to report it. */
+	char* const comma_1 = strchr(descriptor, ',');
+	char* const comma_2 = comma_1 == NULL ? NULL : strchr(comma_1 + 1, ',');
+	char* const comma_3 = comma_2 == NULL ? NULL : strchr(comma_2 + 1, ',');
+	char* const comma_4 = comma_3 == NULL ? NULL : strchr(comma_3 + 1, ',');
+	unsigned long starting_address;
+	unsigned int processor_family = P2BIN_PROCESSOR_FAMILY_Z80;
+	unsigned int candidate_compressions = 0;
+	int fast = 0;
+	size_t compression_length, i;
+	P2Bin_Compression compression;
+	P2Bin_Type type;
+	char *compression_string, *constant, *type_string;
+
+	if (sscanf(descriptor, "%lX", &starting_address) != 1 || comma_1 == NULL || comma_2 == NULL || comma_3 == NULL)
+		return 0;
+
+	compression_string = comma_1 + 1;
+	constant = comma_2 + 1;
+	type_string = comma_3 + 1;
+
+	/* Break the descriptor into substrings. */
+	*comma_1 = '\0';
+	*comma_2 = '\0';
+	*comma_3 = '\0';
+
+	/* Determine processor family. */
+	if (comma_4 != NULL)
+	{
+		const char* const family_string = comma_4 + 1;
+		char *end;
 
-	return ftell(output_file);
-}
+		*comma_4 = '\0';
 
-static const ClownLZSS_Callbacks clownlzss_callbacks = {NULL, ClownLZSSCallback_Write, ClownLZSSCallback_Seek, ClownLZSSCallback_Tell};
+		if (strcmp(family_string, "z80") == 0)
+			processor_family = P2BIN_PROCESSOR_FAMILY_Z80;
+		else if (strcmp(family_string, "68000") == 0)
+			processor_family = P2BIN_PROCESSOR_FAMILY_68000;
+		else
+		{
+			const unsigned long value = strtoul(family_string, &end, 16);
 
-static int LZSS_ReadByte(void* const user_data)
-{
-	(void)user_data;
+			if (*family_string == '\0' || *end != '\0' || value > 0xFF)
+			{
+				JobError(job, "Unrecognised processor family ('%.200s') in %.200s.", family_string, location);
+				return 1;
+			}
 
-	return z80_read_index == z80_write_index ? EOF : z80_buffer[z80_read_index++];
-}
+			processor_family = (unsigned int)value;
+		}
+	}
 
-static void NotEnoughSpace(const CompressedSegment* const compressed_segment, const unsigned long compressed_z80_code_size)
-{
-	fprintf(stderr, "Error: Space reserved for the compressed Z80 segments is too small. Set '%s' to at least $%lX.\n", compressed_segment->constant, compressed_z80_code_size);
-	longjmp(jump_buffer, 1);
-}
+	/* A ':fast' suffix trades compression ratio for speed. */
+	compression_length = strlen(compression_string);
 
-static unsigned long EmitCompressedZ80Code(void)
-{
-	if (current_compressed_segment != NULL)
+	if (compression_length >= 5 && strcmp(&compression_string[compression_length - 5], ":fast") == 0)
 	{
-		unsigned long start_address, end_address, compressed_z80_code_size;
+		compression_string[compression_length - 5] = '\0';
+		fast = 1;
+	}
 
-		/* Rewind to the start of the previous segment. */
-		if (current_compressed_segment->type == TYPE_BEFORE)
-			fseek(output_file, previous_68k_segment_start, SEEK_SET);
+	/* Determine compression. 'auto' can be followed by a list of candidate formats separated by '+', such as 'auto:kosinski+saxman'. */
+	if (strncmp(compression_string, "auto:", 5) == 0)
+	{
+		char *candidate = &compression_string[5];
 
-		start_address = ftell(output_file);
+		compression = P2BIN_COMPRESSION_AUTO;
 
-		switch (current_compressed_segment->compression)
+		for (;;)
 		{
-			case COMPRESSION_UNCOMPRESSED:
-				fwrite(z80_buffer, z80_write_index, 1, output_file);
-				break;
+			char* const plus = strchr(candidate, '+');
 
-			case COMPRESSION_KOSINSKI:
-			{
-				static const KosinskiCompressCallbacks callbacks = {NULL, AccurateKosinskiCompressCallback_ReadByte, NULL, AccurateKosinskiCompressCallback_WriteByte};
-				unsigned long bytes_to_pad, i;
+			if (plus != NULL)
+				*plus = '\0';
 
-				KosinskiCompress(&callbacks, cc_false);
+			for (i = 0; i < P2BIN_COMPRESSION_AUTO; ++i)
+				if (strcmp(candidate, P2Bin_compression_names[i]) == 0)
+					break;
 
-				/* Kosinski-compressed data is always padded to 0x10 bytes. */
-				bytes_to_pad = -(ftell(output_file) - start_address) & 0xF;
+			if (i == P2BIN_COMPRESSION_AUTO)
+			{
+				JobError(job, "Unrecognised candidate compression format ('%.200s') in %.200s.", candidate, location);
+				return 1;
+			}
 
-				for (i = 0; i < bytes_to_pad; ++i)
-					fputc(0, output_file);
+			candidate_compressions |= P2BIN_COMPRESSION_FLAG(i);
 
+			if (plus == NULL)
 				break;
-			}
-
-			case COMPRESSION_KOSINSKI_OPTIMISED:
-				if (!ClownLZSS_KosinskiCompress(z80_buffer, z80_write_index, &clownlzss_callbacks))
-				{
-					fputs("Error: Failed to allocate memory for compressor.\n", stderr);
-					longjmp(jump_buffer, 1);
-				}
 
+			candidate = plus + 1;
+		}
+	}
+	else
+	{
+		for (i = 0; i < sizeof(P2Bin_compression_names) / sizeof(*P2Bin_compression_names); ++i)
+			if (strcmp(compression_string, P2Bin_compression_names[i]) == 0)
 				break;
 
-			case COMPRESSION_SAXMAN:
-			case COMPRESSION_SAXMAN_BUGGED:
-			{
-				long before, after;
+		if (i == sizeof(P2Bin_compression_names) / sizeof(*P2Bin_compression_names))
+		{
+			JobError(job, "Unrecognised compression format ('%.200s') in %.200s.", compression_string, location);
+			return 1;
+		}
 
-				before = ftell(output_file);
-				Encode(LZSS_ReadByte, NULL, output_file);
-				after = ftell(output_file);
+		compression = (P2Bin_Compression)i;
+	}
 
-				if (current_compressed_segment->compression == COMPRESSION_SAXMAN_BUGGED)
-				{
-					/* Insert a dumb garbage byte depending on if the compressed data is an
-					   odd or even number of bytes long. This garbage byte is processed by
-					   the decompressor, causing garbage data to be generated past the end
-					   of the decompressed data. */
-					/*
-					https://forums.sonicretro.org/index.php?threads/the-mystery-of-sonic-2s-subtly-broken-sound-driver-compression.41804/
-					https://sonicresearch.org/community/index.php?threads/the-mystery-of-sonic-2s-subtly-broken-sound-driver-compression.6772/
-					https://clownacy.wordpress.com/2023/06/07/the-mystery-of-sonic-2s-subtly-broken-sound-driver-compression/
-					*/
-					const int garbage_byte = (after - before) % 2 != 0 ? 0x4E : 0x00;
-					fputc(garbage_byte, output_file);
-				}
+	if (fast && compression == P2BIN_COMPRESSION_KOSINSKIPLUS)
+		JobNote(job, "Kosinski+ has no fast compressor, so the normal one will be used for %.200s.", location);
 
-				break;
-			}
+	/* Determine type. */
+	if (strcmp(type_string, "before") == 0)
+		type = P2BIN_TYPE_BEFORE;
+	else if (strcmp(type_string, "after") == 0)
+		type = P2BIN_TYPE_AFTER;
+	else
+	{
+		JobError(job, "Unrecognised type ('%.200s') in %.200s.", type_string, location);
+		return 1;
+	}
 
-			case COMPRESSION_SAXMAN_OPTIMISED:
-				if (!ClownLZSS_SaxmanCompressWithoutHeader(z80_buffer, z80_write_index, &clownlzss_callbacks))
-				{
-					fputs("Error: Failed to allocate memory for compressor.\n", stderr);
-					longjmp(jump_buffer, 1);
-				}
+	/* Add to list of compressed segments. */
+	if (job->options.total_compressed_segments == job->compressed_segments_capacity)
+	{
+		const size_t new_capacity = job->compressed_segments_capacity == 0 ? 4 : job->compressed_segments_capacity * 2;
+		P2Bin_CompressedSegment* const new_compressed_segments = (P2Bin_CompressedSegment*)realloc(job->compressed_segments, sizeof(P2Bin_CompressedSegment) * new_capacity);
 
-				break;
+		if (new_compressed_segments == NULL)
+		{
+			JobError(job, "Out of memory.");
+			return 1;
+		}
 
-			case COMPRESSION_KOSINSKIPLUS:
-				if (!ClownLZSS_KosinskiPlusCompress(z80_buffer, z80_write_index, &clownlzss_callbacks))
-				{
-					fputs("Error: Failed to allocate memory for compressor.\n", stderr);
-					longjmp(jump_buffer, 1);
-				}
+		job->compressed_segments = new_compressed_segments;
+		job->compressed_segments_capacity = new_capacity;
+	}
 
-				break;
-		}
+	job->compressed_segments[job->options.total_compressed_segments].processor_family = processor_family;
+	job->compressed_segments[job->options.total_compressed_segments].starting_address = starting_address;
+	job->compressed_segments[job->options.total_compressed_segments].compression = compression;
+	job->compressed_segments[job->options.total_compressed_segments].candidate_compressions = candidate_compressions;
+	job->compressed_segments[job->options.total_compressed_segments].fast = fast;
+	job->compressed_segments[job->options.total_compressed_segments].constant = constant;
+	job->compressed_segments[job->options.total_compressed_segments].type = type;
+	++job->options.total_compressed_segments;
 
-		end_address = ftell(output_file);
+	return 1;
+}
 
-		if (end_address > maximum_address)
-			maximum_address = end_address;
+static int ParseFixup(Job* const job, char* const descriptor)
+{
+	/* Parses a fix-up of the form '[address],[constant],[value]', where the value can end with a size of '.b', '.w', or '.l'.
+	   Returns 0 if the fix-up is malformed, leaving the caller to report it. */
+	char* const comma_1 = strchr(descriptor, ',');
+	char* const comma_2 = comma_1 == NULL ? NULL : strchr(comma_1 + 1, ',');
+	char *constant, *value_string, *dot;
+	unsigned long address;
+	unsigned int size = 4;
+	P2Bin_FixupValue value;
 
-		compressed_z80_code_size = end_address - start_address;
+	if (sscanf(descriptor, "%lX", &address) != 1 || comma_1 == NULL || comma_2 == NULL)
+		return 0;
 
-		/* Check if we fit within the previous segment. */
-		if (current_compressed_segment->type == TYPE_BEFORE && compressed_z80_code_size > previous_68k_segment_length)
-			NotEnoughSpace(current_compressed_segment, compressed_z80_code_size);
+	constant = comma_1 + 1;
+	value_string = comma_2 + 1;
 
-		current_compressed_segment = NULL;
+	/* Break the descriptor into substrings. */
+	*comma_1 = '\0';
+	*comma_2 = '\0';
 
-		return compressed_z80_code_size;
-	}
+	/* Determine size. */
+	dot = strchr(value_string, '.');
 
-	return 0;
-}
+	if (dot != NULL)
+	{
+		*dot = '\0';
+
+		if (strcmp(dot + 1, "b") == 0)
+			size = 1;
+		else if (strcmp(dot + 1, "w") == 0)
+			size = 2;
+		else if (strcmp(dot + 1, "l") == 0)
+			size = 4;
+		else
+			return 0;
+	}
 
-static void ProcessSegment(const unsigned int processor_family)
-{
-	const unsigned long start_address = ReadLongInt();
-	const unsigned int length = ReadWord();
-	const unsigned long end_address = start_address + length;
-	const CompressedSegment *matching_compressed_segment = NULL;
-	const cc_bool is_continued_compressed_segment = processor_family == 0x51 && current_compressed_segment != NULL && start_address == last_z80_segment_end;
-
-	if (processor_family == 0x51)
-		for (matching_compressed_segment = compressed_segment_list_head; matching_compressed_segment != NULL; matching_compressed_segment = matching_compressed_segment->next)
-			if (start_address == matching_compressed_segment->starting_address)
-				break;
+	/* Determine value. */
+	if (strcmp(value_string, "size") == 0)
+		value = P2BIN_FIXUP_SIZE;
+	else if (strcmp(value_string, "start") == 0)
+		value = P2BIN_FIXUP_START;
+	else if (strcmp(value_string, "end") == 0)
+		value = P2BIN_FIXUP_END;
+	else
+		return 0;
 
-	/* Sound driver Z80 code must be compressed.
-	   The telltale sign of compressable Z80 code is that its first segment has an address of 0. */
-	if (matching_compressed_segment != NULL || is_continued_compressed_segment)
+	/* Add to list of fix-ups. */
+	if (job->options.total_fixups == job->fixups_capacity)
 	{
-		/* What we do is read as many consecutive Z80 segments as possible into a buffer and then
-		   compress and emit it when we encounter a non-Z80 segment or the end of the code file. */
+		const size_t new_capacity = job->fixups_capacity == 0 ? 4 : job->fixups_capacity * 2;
+		P2Bin_Fixup* const new_fixups = (P2Bin_Fixup*)realloc(job->fixups, sizeof(P2Bin_Fixup) * new_capacity);
 
-		/* If we encounter an eligible segment that doesn't continue directly
-		   after the last one, then begin a new compressed chunk. */
-		if (!is_continued_compressed_segment)
+		if (new_fixups == NULL)
 		{
-			EmitCompressedZ80Code();
-
-			current_compressed_segment = matching_compressed_segment;
-			z80_read_index = z80_write_index = 0;
+			JobError(job, "Out of memory.");
+			return 1;
 		}
 
-		last_z80_segment_end = end_address;
+		job->fixups = new_fixups;
+		job->fixups_capacity = new_capacity;
+	}
+
+	job->fixups[job->options.total_fixups].address = address;
+	job->fixups[job->options.total_fixups].size = size;
+	job->fixups[job->options.total_fixups].constant = constant;
+	job->fixups[job->options.total_fixups].value = value;
+	++job->options.total_fixups;
 
-		if (z80_write_index + length > sizeof(z80_buffer))
-		{
-			fputs("Error: Compressed Z80 segment is too large.\n", stderr);
-			longjmp(jump_buffer, 1);
-		}
+	return 1;
+}
 
-		ReadBytes(&z80_buffer[z80_write_index], length);
-		z80_write_index += length;
+static void LoadDescriptorFile(Job* const job, const char* const filename)
+{
+	/* A descriptor file holds one compressed segment descriptor per line, in the same format as the '-z' argument.
+	   This avoids hitting command line length limits when there are many compressed segments. */
+	FILE* const file = fopen(filename, "rb");
+
+	if (file == NULL)
+	{
+		JobError(job, "Could not open descriptor file '%.200s' for reading.", filename);
 	}
 	else
 	{
-		static unsigned char copy_buffer[0x1000];
+		size_t size;
+		char* const contents = (char*)File_ReadWhole(file, &size);
 
-		unsigned long i;
+		fclose(file);
 
-		/* If a compressed Z80 segment is in-progress, then output it. */
-		if (current_compressed_segment != NULL)
+		if (contents == NULL)
+		{
+			JobError(job, "Could not read descriptor file '%.200s'.", filename);
+		}
+		else
 		{
-			const CompressedSegment* const compressed_segment = current_compressed_segment;
+			/* The segments' constants point into the file's contents, so it must be kept around until the job is done. */
+			char** const new_descriptor_files = (char**)realloc(job->descriptor_files, sizeof(*job->descriptor_files) * (job->total_descriptor_files + 1));
 
-			const unsigned long compressed_z80_code_size = EmitCompressedZ80Code();
+			if (new_descriptor_files == NULL)
+			{
+				JobError(job, "Out of memory.");
+				free(contents);
+			}
+			else
+			{
+				char *line = contents;
+				unsigned long line_number = 1;
 
-			/* If the segment after the compressed data overlaps it, then not enough space was allocated for it. */
-			if (compressed_segment->type == TYPE_AFTER && start_address < (unsigned long)ftell(output_file))
-				NotEnoughSpace(compressed_segment, compressed_z80_code_size);
+				job->descriptor_files = new_descriptor_files;
+				job->descriptor_files[job->total_descriptor_files++] = contents;
 
-			if (header_filename != NULL)
-			{
-				/* Output the size of the compressed data to the header file for 'fixpointer' to amend the ROM with. */
-				FILE* const header_file = fopen(header_filename, "r+");
+				/* File_ReadWhole always leaves room for a terminator. */
+				contents[size] = '\0';
 
-				if (header_file == NULL)
-				{
-					fputs("Error: Could not open header file for amending.\n", stderr);
-					longjmp(jump_buffer, 1);
-				}
-				else
+				/* Blank lines and lines starting with '#' are ignored. */
+				for (; *line != '\0'; ++line_number)
 				{
-					fprintf(header_file, "comp_z80_size 0x%lX ", compressed_z80_code_size);
-					fclose(header_file);
-				}
-			}
-		}
+					char* const line_end = line + strcspn(line, "\r\n");
+					const char terminator = *line_end;
+					char *descriptor_end = line_end;
+					char *descriptor;
 
-		if (start_address > maximum_address)
-		{
-			/* Set padding bytes between segments. */
-			const unsigned long padding_length = start_address - maximum_address;
+					*line_end = '\0';
 
-			fseek(output_file, maximum_address, SEEK_SET);
+					/* Trim surrounding whitespace. */
+					descriptor = line + strspn(line, " \t");
 
-			for (i = 0; i < padding_length; i += sizeof(padding_buffer))
-				fwrite(padding_buffer, CC_MIN(sizeof(padding_buffer), padding_length - i), 1, output_file);
-		}
-		else
-		{
-			fseek(output_file, start_address, SEEK_SET);
-		}
+					while (descriptor_end != descriptor && (descriptor_end[-1] == ' ' || descriptor_end[-1] == '\t'))
+						*--descriptor_end = '\0';
 
-		/* Copy segment data. We do some batching using a buffer to improve performance. */
-		for (i = 0; i < length; i += sizeof(copy_buffer))
-		{
-			const unsigned long bytes_to_do = CC_MIN(sizeof(copy_buffer), length - i);
+					if (*descriptor != '\0' && *descriptor != '#')
+					{
+						char location[0x100];
 
-			ReadBytes(copy_buffer, bytes_to_do);
-			fwrite(copy_buffer, bytes_to_do, 1, output_file);
-		}
+						sprintf(location, "line %lu of descriptor file '%.200s'", line_number, filename);
 
-		if (end_address > maximum_address)
-			maximum_address = end_address;
+						if (!ParseCompressedSegment(job, descriptor, location))
+							JobError(job, "Could not parse %s.", location);
+					}
+
+					line = line_end;
 
-		previous_68k_segment_start = start_address;
-		previous_68k_segment_length = length;
+					/* Treat '\r\n' as a single line ending. */
+					if (terminator != '\0' && *++line == '\n' && terminator == '\r')
+						++line;
+				}
+			}
+		}
 	}
 }
 
-static cc_bool ProcessRecords(void)
+static void ParseArgument(Job* const job, char* const argument)
 {
-	memset(padding_buffer, padding_value, sizeof(padding_buffer));
-
-	if (setjmp(jump_buffer) == 0)
+	/* A lone '-' is not an option, but a filename that stands for a standard stream. */
+	if (argument[0] == '-' && argument[1] != '\0')
 	{
-		for (;;)
+		switch (argument[1])
 		{
-			const unsigned int record_header = ReadByte();
-			unsigned int processor_family, granularity;
+			case 'z':
+				if (argument[2] != '=' || !ParseCompressedSegment(job, &argument[3], "'-z' argument"))
+					JobError(job, "Could not parse '-z' argument's options.");
 
-			switch (record_header)
-			{
-				case 0:
-					/* Creator string. This marks the end of the file. */
+				return;
 
-					/* Emit the Z80 code here too, just in case it's the last segment in the file. */
-					EmitCompressedZ80Code();
+			case 'f':
+				/* Fix-up. */
+				if (argument[2] != '=' || !ParseFixup(job, &argument[3]))
+					JobError(job, "Could not parse '-f' argument's options.");
 
-					return cc_true;
+				return;
 
-				case 0x80:
-					/* Entry point. We don't care about this. */
-					ReadLongInt();
-					break;
+			case 'd':
+				/* Descriptor file. */
+				if (argument[2] != '=' || argument[3] == '\0')
+					JobError(job, "Could not parse '-d' argument's filename.");
+				else
+					LoadDescriptorFile(job, &argument[3]);
 
-				case 0x81:
-					/* Arbitrary segment. */
-					processor_family = ReadByte();
-					ReadByte(); /* Segment. We don't care about this. */
-					granularity = ReadByte();
+				return;
 
-					if (granularity != 1)
-					{
-						fprintf(stderr, "Error: Unsupported granularity of %u (only 1 is supported).\n", granularity);
-						return cc_false;
-					}
+			case 'c':
+				/* Compression cache directory. */
+				if (argument[2] != '=' || argument[3] == '\0')
+					JobError(job, "Could not parse '-c' argument's directory.");
+				else
+					job->options.cache_directory = &argument[3];
+
+				return;
+
+			case 's':
+				/* Statistics file. */
+				if (argument[2] != '=' || argument[3] == '\0')
+					JobError(job, "Could not parse '-s' argument's filename.");
+				else
+					job->statistics_filename = &argument[3];
 
-					ProcessSegment(processor_family);
+				return;
 
+			case 'u':
+				/* Patch file. */
+				if (argument[2] != '=' || argument[3] == '\0')
+					JobError(job, "Could not parse '-u' argument's filename.");
+				else
+					job->patch_filename = &argument[3];
+
+				return;
+
+			case 'n':
+				/* Plan file. */
+				if (argument[2] != '=' || argument[3] == '\0')
+					JobError(job, "Could not parse '-n' argument's filename.");
+				else
+					job->plan_filename = &argument[3];
+
+				return;
+
+			case 'i':
+				/* Incremental mode. */
+				if (argument[2] != '\0')
 					break;
 
-				default:
-					if (record_header >= 0x80)
-					{
-						fprintf(stderr, "Error: Unrecognised record header value (0x%02X).\n", record_header);
-						return cc_false;
-					}
+				job->incremental = 1;
+				return;
 
-					/* Legacy CODE segment. */
-					ProcessSegment(record_header);
+			case 'm':
+				/* Mega Drive header. */
+				if (argument[2] != '\0')
+					break;
+
+				job->options.mega_drive_header = 1;
+				return;
 
+			case 'w':
+				/* Watch mode. */
+				if (argument[2] != '\0')
 					break;
-			}
+
+				job->watch = 1;
+				return;
+
+			case 'v':
+				/* Verify compressed data. */
+				if (argument[2] != '\0')
+					break;
+
+				job->options.verify = 1;
+				return;
+
+			case 'p':
+				/* Padding value. */
+				if (sscanf(argument, "-p=%X", &job->options.padding_value) == 0)
+					JobError(job, "Could not parse '-p' argument's padding value.");
+				else if (job->options.padding_value > 0xFF)
+					JobError(job, "'-p' argument's padding value is too high (must be 0xFF or lower).");
+
+				return;
 		}
+
+		JobError(job, "Unrecognised option '%.200s'.", argument);
+	}
+	else if (job->input_filename == NULL)
+	{
+		job->input_filename = argument;
+	}
+	else if (job->output_filename == NULL)
+	{
+		job->output_filename = argument;
+	}
+	else if (job->header_filename == NULL)
+	{
+		job->header_filename = argument;
 	}
+}
 
-	return cc_false;
+static const P2Bin_CompressedGroup* FindLastGroupWithConstant(const P2Bin_Result* const result, const size_t index)
+{
+	/* Returns the last group that shares the constant of the group at 'index', or NULL if an earlier group has it,
+	   so that each constant is only listed once, in the order that they first appear. If several groups share
+	   a constant, then the last one wins. */
+	const char* const constant = result->compressed_groups[index].constant;
+	const P2Bin_CompressedGroup *last_group = &result->compressed_groups[index];
+	size_t i;
+
+	for (i = 0; i < index; ++i)
+		if (strcmp(result->compressed_groups[i].constant, constant) == 0)
+			return NULL;
+
+	for (i = index + 1; i < result->total_compressed_groups; ++i)
+		if (strcmp(result->compressed_groups[i].constant, constant) == 0)
+			last_group = &result->compressed_groups[i];
+
+	return last_group;
 }
 
-int main(int argc, char **argv)
+static int WriteHeaderFile(const Job* const job, const P2Bin_Result* const result)
 {
-	int exit_code = EXIT_FAILURE;
-	const char *input_filename = NULL, *output_filename = NULL;
+	/* Marks the start of the list of compressed sizes at the end of the header file. Anything after it is replaced on every run. */
+	static const char marker[] = "\n; p2bin compressed sizes\n";
 
-	if (argc <= 1)
-	{
-		/* Display usage prompt. */
-		/* The message is split because ANSI C has a stupidly-low limit on the largest string literal. */
-		fputs(
-			"Usage: p2bin [options] [input filename] [output filename] [header filename]\n"
-			"\n"
-			"Options:\n"
-			"  -p=[value]\n"
-			"    Set padding byte to the specified value.\n"
-			"  -z=[address],[compression],[constant],[type]\n"
-			"    Specify a compressed series of Z80 segments where...\n"
-			"      address = Starting address of first compressed segment.\n"
-			"      compression = Compression format:\n"
-			"        uncompressed       = Uncompressed\n"
-			"        kosinski           = Kosinski (authentic)\n"
-			"        kosinski-optimised = Kosinski (optimised)\n"
-		, stderr);
-		fputs(
-			"        saxman             = Saxman (authentic)\n"
-			"        saxman-bugged      = Saxman (authentic) with a trailing garbage byte\n"
-			"        saxman-optimised   = Saxman (optimised)\n"
-			"        kosinskiplus       = Kosinski+\n"
-			"      constant = Constant that is used to reserve space for the compressed\n"
-			"        segments.\n"
-			"      type = Method of inserting compressed data:\n"
-			"        before = Overlap the previous segment.\n"
-			"        after  = Insert after the previous segment.\n"
-			"\n"
-		, stderr);
-		fputs(
-			"This tool converts a Macro Assembler AS '.p' code file to a ROM file.\n"
-			"Consecutive Z80 segments starting at a specified address can be compressed in a\n"
-			"specified format, and the size of this compressed data will be written to the\n"
-			"header file.\n"
-		, stderr);
+	int success = 0;
+	const P2Bin_CompressedGroup *legacy_group = NULL;
+	FILE *header_file;
+	size_t i;
 
-		return EXIT_SUCCESS;
-	}
+	if (result->total_compressed_groups == 0)
+		return 1;
 
-	/* Skip filename. */
-	--argc; ++argv;
+	/* The size of the last group that is followed by a segment is written to the start of the file, like it always has been, for 'fixpointer'. */
+	for (i = 0; i < result->total_compressed_groups; ++i)
+		if (result->compressed_groups[i].has_following_segment)
+			legacy_group = &result->compressed_groups[i];
 
-	/* Process arguments. */
-	for (; argc != 0; --argc, ++argv)
+	/* Read the whole header file, so that it can be amended in memory and then written in one go. */
+	header_file = fopen(job->header_filename, "rb");
+
+	if (header_file == NULL)
 	{
-		char* const argument = *argv;
+		JobError(job, "Could not open header file for amending.");
+	}
+	else
+	{
+		size_t header_size;
+		char* const header = (char*)File_ReadWhole(header_file, &header_size);
+
+		fclose(header_file);
 
-		if (argument[0] == '-')
+		if (header == NULL)
 		{
-			switch (argument[1])
+			JobError(job, "Could not read header file.");
+		}
+		else
+		{
+			char legacy_size[0x20];
+			size_t legacy_size_length = 0;
+			const char *old_list;
+			size_t kept_size;
+
+			/* File_ReadWhole always leaves room for a terminator. */
+			header[header_size] = '\0';
+
+			/* Discard the list from a previous run. */
+			old_list = strstr(header, marker);
+			kept_size = old_list == NULL ? header_size : (size_t)(old_list - header);
+
+			if (legacy_group != NULL)
+				legacy_size_length = sprintf(legacy_size, "comp_z80_size 0x%lX ", legacy_group->size);
+
+			header_file = fopen(job->header_filename, "wb");
+
+			if (header_file == NULL)
 			{
-				case 'z':
-				{
-					char* const options = &argument[2];
-					char* const comma_1 = strchr(options, ',');
-					char* const comma_2 = comma_1 == NULL ? NULL : strchr(comma_1 + 1, ',');
-					char* const comma_3 = comma_2 == NULL ? NULL : strchr(comma_2 + 1, ',');
-					unsigned long starting_address;
+				JobError(job, "Could not open header file for amending.");
+			}
+			else
+			{
+				fwrite(legacy_size, 1, legacy_size_length, header_file);
 
-					if (sscanf(options, "=%lX", &starting_address) != 1 || comma_1 == NULL || comma_2 == NULL || comma_3 == NULL)
-					{
-						fputs("Error: Could not parse '-z' argument's options.\n", stderr);
-					}
-					else
-					{
-						Compression compression;
-						Type type;
-						CompressedSegment *compressed_segment;
-
-						char* const compression_string = comma_1 + 1;
-						char* const constant = comma_2 + 1;
-						char* const type_string = comma_3 + 1;
-
-						/* Break the argument into substrings. */
-						*comma_1 = '\0';
-						*comma_2 = '\0';
-						*comma_3 = '\0';
-
-						/* Determine compression. */
-						if (strcmp(compression_string, "uncompressed") == 0)
-							compression = COMPRESSION_UNCOMPRESSED;
-						else if (strcmp(compression_string, "kosinski") == 0)
-							compression = COMPRESSION_KOSINSKI;
-						else if (strcmp(compression_string, "kosinski-optimised") == 0)
-							compression = COMPRESSION_KOSINSKI_OPTIMISED;
-						else if (strcmp(compression_string, "saxman") == 0)
-							compression = COMPRESSION_SAXMAN;
-						else if (strcmp(compression_string, "saxman-bugged") == 0)
-							compression = COMPRESSION_SAXMAN_BUGGED;
-						else if (strcmp(compression_string, "saxman-optimised") == 0)
-							compression = COMPRESSION_SAXMAN_OPTIMISED;
-						else if (strcmp(compression_string, "kosinskiplus") == 0)
-							compression = COMPRESSION_KOSINSKIPLUS;
-						else
-						{
-							fprintf(stderr, "Error: Unrecognised compression format ('%s') in '-z' argument.\n", compression_string);
-							continue;
-						}
+				if (kept_size > legacy_size_length)
+					fwrite(&header[legacy_size_length], 1, kept_size - legacy_size_length, header_file);
 
-						/* Determine type. */
-						if (strcmp(type_string, "before") == 0)
-							type = TYPE_BEFORE;
-						else if (strcmp(type_string, "after") == 0)
-							type = TYPE_AFTER;
-						else
-						{
-							fprintf(stderr, "Error: Unrecognised type ('%s') in '-z' argument.\n", type_string);
-							continue;
-						}
+				/* List the size of every group by its constant. */
+				fputs(marker, header_file);
 
-						/* Add to list of compressed segments. */
-						compressed_segment = (CompressedSegment*)malloc(sizeof(CompressedSegment));
+				for (i = 0; i < result->total_compressed_groups; ++i)
+				{
+					const P2Bin_CompressedGroup* const last_group = FindLastGroupWithConstant(result, i);
 
-						if (compressed_segment == NULL)
-						{
-							fputs("Error: Out of memory.\n", stderr);
-						}
-						else
-						{
-							compressed_segment->next = compressed_segment_list_head;
-							compressed_segment_list_head = compressed_segment;
+					if (last_group != NULL)
+					{
+						fprintf(header_file, "%s 0x%lX\n", last_group->constant, last_group->size);
 
-							compressed_segment->starting_address = starting_address;
-							compressed_segment->compression = compression;
-							compressed_segment->constant = constant;
-							compressed_segment->type = type;
-						}
+						/* Automatically-chosen formats are listed too, so that the assembler can include the matching decompressor. */
+						if (last_group->automatic)
+							fprintf(header_file, "%s_compression equ %u ; %s\n", last_group->constant, (unsigned int)last_group->compression, P2Bin_compression_names[last_group->compression]);
 					}
-
-					continue;
 				}
 
-				break;
-
-				case 'p':
-					/* Padding value. */
-					if (sscanf(argument, "-p=%X", &padding_value) == 0)
-						fputs("Error: Could not parse '-p' argument's padding value.\n", stderr);
-					else if (padding_value > 0xFF)
-						fputs("Error: '-p' argument's padding value is too high (must be 0xFF or lower).\n", stderr);
+				if (ferror(header_file))
+					JobError(job, "Could not write header file.");
+				else
+					success = 1;
 
-					continue;
+				if (fclose(header_file) != 0)
+					success = 0;
 			}
 
-			fprintf(stderr, "Error: Unrecognised option '%s'.\n", argument);
-		}
-		else if (input_filename == NULL)
-		{
-			input_filename = argument;
-		}
-		else if (output_filename == NULL)
-		{
-			output_filename = argument;
-		}
-		else if (header_filename == NULL)
-		{
-			header_filename = argument;
+			free(header);
 		}
 	}
 
-	/* Open input and output files. */
-	input_file = fopen(input_filename, "rb");
+	return success;
+}
+
+static int WritePlanFile(const Job* const job, const P2Bin_Result* const result)
+{
+	/* List the space that every compressed group needs as assembler equates, so that the file can be included by the source code to reserve exactly that much. */
+	int success = 0;
+	const int to_standard_output = File_IsStandardStream(job->plan_filename);
+	FILE* const plan_file = to_standard_output ? stdout : fopen(job->plan_filename, "w");
 
-	if (input_file == NULL)
+	if (plan_file == NULL)
 	{
-		fprintf(stderr, "Error: Could not open input file '%s' for reading.\n", input_filename);
+		JobError(job, "Could not open plan file '%.200s' for writing.", job->plan_filename);
 	}
 	else
 	{
-		output_file = fopen(output_filename, "wb");
+		size_t i;
+
+		fputs("; Space needed by the compressed data, written by p2bin\n", plan_file);
 
-		if (output_file == NULL)
+		for (i = 0; i < result->total_compressed_groups; ++i)
 		{
-			fprintf(stderr, "Error: Could not open output file '%s' for writing.\n", output_filename);
+			const P2Bin_CompressedGroup* const last_group = FindLastGroupWithConstant(result, i);
+
+			if (last_group != NULL)
+			{
+				fprintf(plan_file, "%s equ $%lX\n", last_group->constant, last_group->size);
+
+				if (!last_group->fits)
+					JobNote(job, "'%.200s' does not fit in the space reserved for it: it needs $%lX bytes.", last_group->constant, last_group->size);
+			}
 		}
+
+		if (ferror(plan_file))
+			JobError(job, "Could not write plan file.");
 		else
-		{
-			/* Read and check the header's magic number. */
-			unsigned char magic[2];
+			success = 1;
+
+		if (!to_standard_output && fclose(plan_file) != 0)
+			success = 0;
+	}
 
-			if (fread(magic, sizeof(magic), 1, input_file) == 0)
-				fputs("Error: Could not read header magic value.\n", stderr);
-			else if (magic[0] != 0x89 || magic[1] != 0x14)
-				fprintf(stderr, "Error: Invalid header magic value - expected 0x8914 but got 0x%02X%02X.\nInput file is either corrupt or not a valid AS code file.\n", magic[0], magic[1]);
-			else if (ProcessRecords())
-				exit_code = EXIT_SUCCESS;
+	return success;
+}
 
-			fclose(output_file);
+static int FindChangedRange(const unsigned char* const new_rom, const unsigned char* const old_rom, const size_t compare_size, const size_t merge_distance, size_t* const position, size_t* const start, size_t* const end)
+{
+	/* Finds the next range of bytes from 'position' onwards that differ between the two ROMs. Returns 0 if there are none.
+	   Ranges of changed bytes separated by fewer than 'merge_distance' unchanged bytes are merged together. */
 
-			/* Delete the output file if we failed. The build system relies on this to detect errors. */
-			if (exit_code == EXIT_FAILURE)
-				remove(output_filename);
-		}
+	/* Find the start of the next changed range. */
+	while (*position < compare_size && new_rom[*position] == old_rom[*position])
+		++*position;
 
-		fclose(input_file);
-	}
+	if (*position == compare_size)
+		return 0;
+
+	*start = *position;
+
+	/* Find the end of the changed range. */
+	*end = *position;
+
+	while (*position < compare_size)
+	{
+		if (new_rom[*position] != old_rom[*position])
+			*end = ++*position;
+		else if (*position - *end < merge_distance)
+			++*position;
+		else
+			break;
+	}
+
+	return 1;
+}
+
+static int PatchOutputFile(FILE* const file, const P2Bin_Result* const result, const unsigned char* const old_rom, const size_t old_rom_size, unsigned long* const bytes_written)
+{
+	/* Only write the parts of the ROM that differ from the old one. */
+	/* Ranges are merged if they are close enough, to reduce the number of seeks. */
+	const size_t merge_distance = 0x100;
+	const size_t compare_size = old_rom_size < result->rom_size ? old_rom_size : result->rom_size;
+	size_t position = 0, start, end;
+
+	while (FindChangedRange(result->rom, old_rom, compare_size, merge_distance, &position, &start, &end))
+	{
+		if (fseek(file, start, SEEK_SET) != 0 || fwrite(&result->rom[start], 1, end - start, file) != end - start)
+			return 0;
+
+		*bytes_written += end - start;
+	}
+
+	/* Append whatever lies beyond the end of the old ROM. */
+	if (result->rom_size > compare_size)
+	{
+		if (fseek(file, compare_size, SEEK_SET) != 0 || fwrite(&result->rom[compare_size], 1, result->rom_size - compare_size, file) != result->rom_size - compare_size)
+			return 0;
+
+		*bytes_written += result->rom_size - compare_size;
+	}
+
+	return 1;
+}
+
+static void WriteIPSRecord(FILE* const file, const size_t offset, const size_t size)
+{
+	/* A size of 0 marks a run-length-encoded record. */
+	fputc((int)(offset >> 16 & 0xFF), file);
+	fputc((int)(offset >> 8 & 0xFF), file);
+	fputc((int)(offset >> 0 & 0xFF), file);
+	fputc((int)(size >> 8 & 0xFF), file);
+	fputc((int)(size >> 0 & 0xFF), file);
+}
+
+static void WriteIPSRange(FILE* const file, const unsigned char* const rom, size_t start, const size_t end)
+{
+	/* Runs of a single byte at least this long are run-length-encoded. */
+	const size_t minimum_run = 0x10;
+	/* IPS records have 16-bit sizes. */
+	const size_t maximum_size = 0xFFFF;
+
+	while (start != end)
+	{
+		size_t run, position;
+
+		/* A record cannot begin at $454F46, as its offset would be mistaken for the 'EOF' marker. */
+		if (start == 0x454F46)
+			--start;
+
+		for (run = 1; start + run != end && run != maximum_size && rom[start + run] == rom[start]; ++run);
+
+		if (run >= minimum_run)
+		{
+			WriteIPSRecord(file, start, 0);
+			fputc((int)(run >> 8 & 0xFF), file);
+			fputc((int)(run >> 0 & 0xFF), file);
+			fputc(rom[start], file);
+
+			start += run;
+		}
+		else
+		{
+			/* Stop at the next run that is worth encoding. The record is made at least two bytes long, so that moving away from $454F46 always makes progress. */
+			for (position = start + 1; position != end && position - start != maximum_size; ++position)
+			{
+				if (position - start >= 2)
+				{
+					for (run = 1; position + run != end && run != minimum_run && rom[position + run] == rom[position]; ++run);
+
+					if (run == minimum_run)
+						break;
+				}
+			}
+
+			WriteIPSRecord(file, start, position - start);
+			fwrite(&rom[start], 1, position - start, file);
+
+			start = position;
+		}
+	}
+}
+
+static int WritePatchFile(const Job* const job, const P2Bin_Result* const result, const unsigned char* const old_rom, const size_t old_rom_size)
+{
+	/* Write an IPS patch that turns the old ROM into the new one, so that only the changes need to be sent to wherever the ROM is run. */
+	/* A record has five bytes of overhead, so ranges that are closer than that are cheaper to merge. */
+	const size_t merge_distance = 6;
+	const size_t compare_size = old_rom_size < result->rom_size ? old_rom_size : result->rom_size;
+	size_t position = 0, start, end;
+	FILE *file;
+
+	/* IPS offsets are 24-bit. */
+	if (result->rom_size > 0x1000000)
+	{
+		JobError(job, "The ROM is too large to make an IPS patch of.");
+		return 0;
+	}
+
+	file = fopen(job->patch_filename, "wb");
+
+	if (file == NULL)
+	{
+		JobError(job, "Could not open patch file '%.200s' for writing.", job->patch_filename);
+		return 0;
+	}
+
+	fputs("PATCH", file);
+
+	while (FindChangedRange(result->rom, old_rom, compare_size, merge_distance, &position, &start, &end))
+		WriteIPSRange(file, result->rom, start, end);
+
+	/* Whatever lies beyond the end of the old ROM is new. */
+	WriteIPSRange(file, result->rom, compare_size, result->rom_size);
+
+	fputs("EOF", file);
+
+	/* If the ROM shrank, then the size is appended, which most patchers understand as an instruction to truncate the ROM. */
+	if (result->rom_size < old_rom_size)
+	{
+		fputc((int)(result->rom_size >> 16 & 0xFF), file);
+		fputc((int)(result->rom_size >> 8 & 0xFF), file);
+		fputc((int)(result->rom_size >> 0 & 0xFF), file);
+	}
+
+	{
+		const int write_failed = ferror(file);
+
+		if (fclose(file) != 0 || write_failed)
+		{
+			JobError(job, "Could not write patch file '%.200s'.", job->patch_filename);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int WriteSparseFile(FILE* const file, const unsigned char* const data, const size_t size, unsigned long* const bytes_written)
+{
+	/* Write data to a new file, seeking over large blocks of zeroes instead of writing them.
+	   On file systems that support it, this leaves holes in the file, saving on both disk
+	   space and write bandwidth for ROMs with large unused regions. Everywhere else, the
+	   gaps are zero-filled by the operating system, so the file is the same either way. */
+	const size_t block_size = 0x10000;
+	size_t position = 0, written = 0;
+
+	while (position != size)
+	{
+		const size_t remaining = size - position;
+		const size_t this_block_size = remaining < block_size ? remaining : block_size;
+		const unsigned char* const block = &data[position];
+
+		/* The last block is always written, so that the file ends up the right size. */
+		if (this_block_size == block_size && this_block_size != remaining && block[0] == 0 && memcmp(block, block + 1, this_block_size - 1) == 0)
+		{
+			/* Flush the data before the hole in one go. */
+			if (fwrite(&data[written], 1, position - written, file) != position - written)
+				return 0;
+
+			*bytes_written += position - written;
+
+			if (fseek(file, (long)this_block_size, SEEK_CUR) != 0)
+				return 0;
+
+			written = position + this_block_size;
+		}
+
+		position += this_block_size;
+	}
+
+	if (fwrite(&data[written], 1, size - written, file) != size - written)
+		return 0;
+
+	*bytes_written += size - written;
+
+	return 1;
+}
+
+static int WriteOutputFile(Job* const job, const P2Bin_Result* const result)
+{
+	int success = 0;
+	const unsigned char *old_rom = job->previous_rom;
+	size_t old_rom_size = job->previous_rom_size;
+	unsigned char *loaded_rom = NULL;
+	FILE *file;
+
+	/* The ROM is already complete in memory, so it can be streamed straight to the next tool in a pipeline. */
+	if (File_IsStandardStream(job->output_filename))
+	{
+		File_SetBinaryMode(stdout);
+
+		if (fwrite(result->rom, 1, result->rom_size, stdout) != result->rom_size || fflush(stdout) != 0)
+		{
+			JobError(job, "Could not write to standard output.");
+			return 0;
+		}
+
+		job->bytes_written = result->rom_size;
+
+		return 1;
+	}
+
+	/* A patch needs the old ROM too. */
+	if ((job->incremental || job->patch_filename != NULL) && old_rom == NULL)
+	{
+		/* Load the ROM from the previous build, if there is one. */
+		file = fopen(job->output_filename, "rb");
+
+		if (file != NULL)
+		{
+			old_rom = loaded_rom = File_ReadWhole(file, &old_rom_size);
+			fclose(file);
+		}
+	}
+
+	/* Standard C cannot shrink a file, so the whole ROM is rewritten if it got smaller. */
+	if ((job->incremental || job->watch) && old_rom != NULL && old_rom_size <= result->rom_size)
+	{
+		file = fopen(job->output_filename, "r+b");
+
+		if (file == NULL)
+		{
+			JobError(job, "Could not open output file '%.200s' for amending.", job->output_filename);
+		}
+		else
+		{
+			const int write_failed = !PatchOutputFile(file, result, old_rom, old_rom_size, &job->bytes_written);
+
+			if (fclose(file) != 0 || write_failed)
+				JobError(job, "Could not write output file '%.200s'.", job->output_filename);
+			else
+				success = 1;
+		}
+	}
+	else
+	{
+		file = fopen(job->output_filename, "wb");
+
+		if (file == NULL)
+		{
+			JobError(job, "Could not open output file '%.200s' for writing.", job->output_filename);
+		}
+		else
+		{
+			const int write_failed = !WriteSparseFile(file, result->rom, result->rom_size, &job->bytes_written);
+
+			if (fclose(file) != 0 || write_failed)
+				JobError(job, "Could not write output file '%.200s'.", job->output_filename);
+			else
+				success = 1;
+		}
+	}
+
+	/* Without a previous build, the patch holds the whole ROM. */
+	if (success && job->patch_filename != NULL)
+		success = WritePatchFile(job, result, old_rom, old_rom == NULL ? 0 : old_rom_size);
+
+	free(loaded_rom);
+
+	return success;
+}
+
+static void WriteJSONString(FILE* const file, const char* const string)
+{
+	const char *character;
+
+	fputc('"', file);
+
+	for (character = string; *character != '\0'; ++character)
+	{
+		if (*character == '"' || *character == '\\')
+			fprintf(file, "\\%c", *character);
+		else if ((unsigned char)*character < 0x20)
+			fprintf(file, "\\u%04X", (unsigned char)*character);
+		else
+			fputc(*character, file);
+	}
+
+	fputc('"', file);
+}
+
+static int WriteStatisticsFile(const Job* const job, const P2Bin_Result* const result, const double read_time, const double write_time)
+{
+	/* Output the statistics as JSON, so that they can be collected by other tools. */
+	const P2Bin_Statistics* const statistics = &result->statistics;
+	FILE* const file = fopen(job->statistics_filename, "w");
+	int success;
+	size_t i;
+	const char *separator;
+
+	if (file == NULL)
+	{
+		JobError(job, "Could not open statistics file '%.200s' for writing.", job->statistics_filename);
+		return 0;
+	}
+
+	fputs("{\n\t\"input\": ", file);
+	WriteJSONString(file, job->input_filename);
+	fputs(",\n\t\"output\": ", file);
+	WriteJSONString(file, job->output_filename);
+	fprintf(file, ",\n\t\"bytes_read\": %lu,\n", statistics->bytes_read);
+	fprintf(file, "\t\"bytes_written\": %lu,\n", job->bytes_written);
+	fprintf(file, "\t\"rom_size\": %lu,\n", (unsigned long)result->rom_size);
+	fprintf(file, "\t\"segment_bytes\": %lu,\n", statistics->segment_bytes);
+	fprintf(file, "\t\"padding_bytes\": %lu,\n", statistics->padding_bytes);
+
+	fputs("\t\"phases\": {\n", file);
+	fprintf(file, "\t\t\"read\": %f,\n", read_time);
+	fprintf(file, "\t\t\"parse\": %f,\n", statistics->parse_time);
+	fprintf(file, "\t\t\"compression\": %f,\n", statistics->compression_time);
+	fprintf(file, "\t\t\"layout\": %f,\n", statistics->layout_time);
+	fprintf(file, "\t\t\"write\": %f\n", write_time);
+	fputs("\t},\n", file);
+
+	/* Processor families are keyed by their AS family code. */
+	fputs("\t\"segments_per_family\": {", file);
+	separator = "\n";
+
+	for (i = 0; i < sizeof(statistics->segments_per_family) / sizeof(*statistics->segments_per_family); ++i)
+	{
+		if (statistics->segments_per_family[i] != 0)
+		{
+			fprintf(file, "%s\t\t\"0x%02X\": %lu", separator, (unsigned int)i, statistics->segments_per_family[i]);
+			separator = ",\n";
+		}
+	}
+
+	fputs("\n\t},\n", file);
+
+	fputs("\t\"compressed_groups\": [", file);
+	separator = "\n";
+
+	for (i = 0; i < result->total_compressed_groups; ++i)
+	{
+		const P2Bin_CompressedGroup* const group = &result->compressed_groups[i];
+
+		fprintf(file, "%s\t\t{\n\t\t\t\"constant\": ", separator);
+		WriteJSONString(file, group->constant);
+		fprintf(file, ",\n\t\t\t\"compression\": \"%s\",\n", P2Bin_compression_names[group->compression]);
+		fprintf(file, "\t\t\t\"automatic\": %s,\n", group->automatic ? "true" : "false");
+		fprintf(file, "\t\t\t\"address\": %lu,\n", group->address);
+		fprintf(file, "\t\t\t\"uncompressed_size\": %lu,\n", group->uncompressed_size);
+		fprintf(file, "\t\t\t\"compressed_size\": %lu,\n", group->size);
+		fprintf(file, "\t\t\t\"ratio\": %f,\n", group->uncompressed_size == 0 ? 0.0 : (double)group->size / group->uncompressed_size);
+		fprintf(file, "\t\t\t\"time\": %f,\n", group->compression_time);
+		fprintf(file, "\t\t\t\"cached\": %s\n\t\t}", group->cached ? "true" : "false");
+		separator = ",\n";
+	}
+
+	fputs("\n\t]\n}\n", file);
+
+	success = !ferror(file);
+
+	if (fclose(file) != 0)
+		success = 0;
+
+	if (!success)
+		JobError(job, "Could not write statistics file '%.200s'.", job->statistics_filename);
+
+	return success;
+}
+
+static void RunJob(void* const user_data, const size_t job_index)
+{
+	Job* const job = &((Job*)user_data)[job_index];
+	const double start_time = Timer_GetSeconds();
+	FILE *input_file;
+
+	/* A ROM is not built when planning, so no output file is needed. */
+	if (job->input_filename == NULL || (job->output_filename == NULL && job->plan_filename == NULL))
+	{
+		JobError(job, "An input filename and an output filename must be specified.");
+		return;
+	}
+
+	/* The previous build is read from the output file, which is not possible with standard output. */
+	if (job->patch_filename != NULL && job->plan_filename == NULL && File_IsStandardStream(job->output_filename))
+	{
+		JobError(job, "A patch file cannot be written when the output is standard output.");
+		return;
+	}
+
+	/* Read the input file into memory. This allows the code file to be piped in from the assembler. */
+	if (File_IsStandardStream(job->input_filename))
+	{
+		input_file = stdin;
+		File_SetBinaryMode(input_file);
+	}
+	else
+	{
+		input_file = fopen(job->input_filename, "rb");
+	}
+
+	if (input_file == NULL)
+	{
+		JobError(job, "Could not open input file '%.200s' for reading.", job->input_filename);
+	}
+	else
+	{
+		File_Contents input;
+		int read_input;
+
+		/* Mapping the whole file spares large code files from being copied into memory before being copied into the ROM.
+		   The assembler may rewrite the file while it is being watched, however, and a mapping does not survive that. */
+		if (input_file != stdin && !job->watch)
+		{
+			read_input = File_ReadContents(input_file, &input);
+		}
+		else
+		{
+			input.data = File_ReadWhole(input_file, &input.size);
+			input.mapped = 0;
+			read_input = input.data != NULL;
+		}
+
+		if (input_file != stdin)
+			fclose(input_file);
+
+		if (!read_input)
+		{
+			JobError(job, "Could not read input file '%.200s'.", job->input_filename);
+		}
+		else
+		{
+			const double read_time = Timer_GetSeconds() - start_time;
+			P2Bin_Result result;
+
+			job->options.compressed_segments = job->compressed_segments;
+			job->options.fixups = job->fixups;
+			job->options.plan = job->plan_filename != NULL;
+
+			/* The ROM is built in memory, and then written to the output file all at once. */
+			if (P2Bin_Convert(input.data, input.size, &job->options, &result))
+			{
+				const double write_start_time = Timer_GetSeconds();
+				size_t i;
+
+				for (i = 0; i < result.total_compressed_groups; ++i)
+					if (result.compressed_groups[i].automatic)
+						JobNote(job, "'%.200s' was compressed with '%s' ($%lX bytes).", result.compressed_groups[i].constant, P2Bin_compression_names[result.compressed_groups[i].compression], result.compressed_groups[i].size);
+
+				if (job->plan_filename != NULL)
+					job->success = WritePlanFile(job, &result);
+				else if ((job->header_filename == NULL || WriteHeaderFile(job, &result)) && WriteOutputFile(job, &result))
+					job->success = job->statistics_filename == NULL || WriteStatisticsFile(job, &result, read_time, Timer_GetSeconds() - write_start_time);
+
+				/* Keep the ROM for the next build to compare against. */
+				free(job->previous_rom);
+				job->previous_rom = NULL;
+
+				if (job->watch && job->success)
+				{
+					job->previous_rom = result.rom;
+					job->previous_rom_size = result.rom_size;
+					result.rom = NULL;
+				}
+
+				P2Bin_FreeResult(&result);
+			}
+
+			/* Delete the output file if we failed. The build system relies on this to detect errors. */
+			if (job->plan_filename != NULL)
+			{
+				/* No ROM is written when planning, so it is the plan file that must go instead, so that a stale one is not included. */
+				if (!job->success && !File_IsStandardStream(job->plan_filename))
+					remove(job->plan_filename);
+			}
+			else if (!job->success && !File_IsStandardStream(job->output_filename))
+			{
+				remove(job->output_filename);
+
+				free(job->previous_rom);
+				job->previous_rom = NULL;
+			}
+
+			File_FreeContents(&input);
+		}
+	}
+}
+
+static int RunBatch(const char* const manifest_filename)
+{
+	int success = 0;
+	FILE* const manifest_file = fopen(manifest_filename, "rb");
+
+	if (manifest_file == NULL)
+	{
+		fprintf(stderr, "Error: Could not open manifest file '%s' for reading.\n", manifest_filename);
+	}
+	else
+	{
+		size_t manifest_size;
+		/* The jobs' arguments point into this, so it must outlive them. */
+		char* const manifest = (char*)File_ReadWhole(manifest_file, &manifest_size);
+
+		fclose(manifest_file);
+
+		if (manifest == NULL)
+		{
+			fprintf(stderr, "Error: Could not read manifest file '%s'.\n", manifest_filename);
+		}
+		else
+		{
+			P2Bin_Cache* const cache = P2Bin_CreateCache();
+			Job *jobs = NULL;
+			size_t total_jobs = 0, jobs_capacity = 0;
+			char *line = manifest;
+			size_t i;
+
+			/* File_ReadWhole always leaves room for a terminator. */
+			manifest[manifest_size] = '\0';
+
+			success = 1;
+
+			/* Each line holds the arguments for one job. Blank lines and lines starting with '#' are ignored. */
+			while (success && *line != '\0')
+			{
+				char* const line_end = line + strcspn(line, "\r\n");
+				char* const next_line = line_end + (*line_end != '\0');
+				char *pointer = line + strspn(line, " \t");
+				Job *job = NULL;
+
+				*line_end = '\0';
+
+				/* A comment can be indented, like any other line. */
+				if (*pointer == '#')
+					*pointer = '\0';
+
+				for (;;)
+				{
+					char *argument;
+
+					/* Skip whitespace. */
+					pointer += strspn(pointer, " \t");
+
+					if (*pointer == '\0')
+						break;
+
+					/* Arguments can be quoted, to allow for filenames containing spaces. */
+					if (*pointer == '"')
+					{
+						argument = ++pointer;
+						pointer += strcspn(pointer, "\"");
+					}
+					else
+					{
+						argument = pointer;
+						pointer += strcspn(pointer, " \t");
+					}
+
+					if (*pointer != '\0')
+						*pointer++ = '\0';
+
+					if (job == NULL)
+					{
+						if (total_jobs == jobs_capacity)
+						{
+							const size_t new_capacity = jobs_capacity == 0 ? 8 : jobs_capacity * 2;
+							Job* const new_jobs = (Job*)realloc(jobs, sizeof(Job) * new_capacity);
+
+							if (new_jobs == NULL)
+							{
+								fputs("Error: Out of memory.\n", stderr);
+								success = 0;
+								break;
+							}
+
+							jobs = new_jobs;
+							jobs_capacity = new_capacity;
+						}
+
+						job = &jobs[total_jobs++];
+						InitialiseJob(job);
+						job->options.cache = cache;
+					}
+
+					ParseArgument(job, argument);
+				}
+
+				line = next_line;
+			}
+
+			if (success)
+			{
+				for (i = 0; i < total_jobs; ++i)
+				{
+					/* Several jobs cannot share the standard streams. */
+					if ((jobs[i].input_filename != NULL && File_IsStandardStream(jobs[i].input_filename))
+					 || (jobs[i].output_filename != NULL && File_IsStandardStream(jobs[i].output_filename))
+					 || (jobs[i].plan_filename != NULL && File_IsStandardStream(jobs[i].plan_filename)))
+					{
+						fputs("Error: Standard input and output cannot be used in batch mode.\n", stderr);
+						success = 0;
+						break;
+					}
+
+					/* The jobs array will not move any more, so the error callbacks can safely point into it now. */
+					jobs[i].options.error_callback_user_data = &jobs[i];
+					jobs[i].name = jobs[i].output_filename != NULL ? jobs[i].output_filename : jobs[i].plan_filename;
+				}
+			}
+
+			if (success)
+			{
+				/* Up to one job per processor is done at once, and each job compresses on threads of its own,
+				   so the processors are divided between the jobs instead of each job getting all of them. */
+				const size_t total_processors = Thread_GetTotalProcessors();
+				const size_t total_concurrent_jobs = total_jobs < total_processors ? total_jobs : total_processors;
+
+				for (i = 0; i < total_jobs; ++i)
+					jobs[i].options.total_threads = total_processors / total_concurrent_jobs;
+
+				Thread_RunJobs(RunJob, jobs, total_jobs);
+
+				/* Report the outcome of every job. */
+				for (i = 0; i < total_jobs; ++i)
+				{
+					fprintf(stderr, "%s: %s\n", jobs[i].name != NULL ? jobs[i].name : "(unnamed)", jobs[i].success ? "success" : "failure");
+
+					if (!jobs[i].success)
+						success = 0;
+				}
+			}
+
+			for (i = 0; i < total_jobs; ++i)
+				DeinitialiseJob(&jobs[i]);
+
+			free(jobs);
+
+			if (cache != NULL)
+				P2Bin_DestroyCache(cache);
+
+			free(manifest);
+		}
+	}
+
+	return success;
+}
+
+static void RunWatch(Job* const job)
+{
+	/* Rebuild the ROM whenever the input file changes. This only returns if watching is impossible.
+	   Compressed data and the ROM are kept in memory between builds, so that only what changed needs to be redone. */
+	const unsigned int poll_interval = 100; /* In milliseconds. */
+	P2Bin_Cache *cache;
+	File_Stamp stamp, new_stamp;
+
+	if (job->input_filename == NULL || job->output_filename == NULL)
+	{
+		JobError(job, "An input filename and an output filename must be specified.");
+		return;
+	}
+
+	if (job->plan_filename != NULL)
+	{
+		JobError(job, "Watch mode cannot be combined with '-n'.");
+		return;
+	}
+
+	if (File_IsStandardStream(job->input_filename))
+	{
+		JobError(job, "Standard input cannot be watched.");
+		return;
+	}
+
+	if (!File_GetStamp(job->input_filename, &stamp))
+	{
+		JobError(job, "Could not check input file '%.200s' for changes.", job->input_filename);
+		return;
+	}
+
+	/* If this fails, then every build just starts cold. */
+	cache = P2Bin_CreateCache();
+	job->options.cache = cache;
+
+	for (;;)
+	{
+		const double start_time = Timer_GetSeconds();
+
+		job->success = 0;
+		RunJob(job, 0);
+
+		/* Forget any data that did not appear in this build. */
+		if (cache != NULL)
+			P2Bin_TrimCache(cache);
+
+		if (job->success)
+			JobNote(job, "Built '%.200s' in %.3f seconds. Waiting for '%.200s' to change...", job->output_filename, Timer_GetSeconds() - start_time, job->input_filename);
+		else
+			JobNote(job, "Waiting for '%.200s' to change...", job->input_filename);
+
+		/* Wait for the file to change... */
+		do
+			Timer_Sleep(poll_interval);
+		while (!File_GetStamp(job->input_filename, &new_stamp) || File_StampsMatch(&stamp, &new_stamp));
+
+		/* ...and then for it to stop changing, so that a half-written file is not read. */
+		do
+		{
+			stamp = new_stamp;
+			Timer_Sleep(poll_interval);
+		} while (!File_GetStamp(job->input_filename, &new_stamp) || !File_StampsMatch(&stamp, &new_stamp));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int exit_code = EXIT_FAILURE;
+	Job job;
+
+	if (argc <= 1)
+	{
+		/* Display usage prompt. */
+		/* The message is split because ANSI C has a stupidly-low limit on the largest string literal. */
+		fputs(
+			"Usage: p2bin [options] [input filename] [output filename] [header filename]\n"
+			"\n"
+			"Options:\n"
+			"  -p=[value]\n"
+			"    Set padding byte to the specified value.\n"
+			"  -z=[address],[compression],[constant],[type][,family]\n"
+			"    Specify a compressed series of segments where...\n"
+			"      address = Starting address of first compressed segment.\n"
+			"      compression = Compression format:\n"
+			"        uncompressed       = Uncompressed\n"
+			"        kosinski           = Kosinski (authentic)\n"
+			"        kosinski-optimised = Kosinski (optimised)\n"
+		, stderr);
+		fputs(
+			"        saxman             = Saxman (authentic)\n"
+			"        saxman-bugged      = Saxman (authentic) with a trailing garbage byte\n"
+			"        saxman-optimised   = Saxman (optimised)\n"
+			"        kosinskiplus       = Kosinski+\n"
+			"        kosinski-moduled   = Kosinski Moduled (authentic)\n"
+			"        kosinski-moduled-optimised\n"
+			"                           = Kosinski Moduled (optimised)\n"
+		, stderr);
+		fputs(
+			"        auto[:list]        = Whichever of the formats in the list (separated by\n"
+			"                             '+') is smallest. The default list is\n"
+			"                             kosinski-optimised+saxman-optimised+kosinskiplus.\n"
+			"                             The chosen format is written to the header file\n"
+			"                             as '[constant]_compression equ [number]'.\n"
+		, stderr);
+		fputs(
+			"        Adding ':fast' to the compression format (such as\n"
+			"        'kosinski-optimised:fast') uses a fast greedy compressor instead of the\n"
+			"        normal one, for development builds. This works with every Kosinski and\n"
+			"        Saxman format, but not Kosinski+. The output is larger, and is not\n"
+			"        identical to the authentic compressors' output.\n"
+		, stderr);
+		fputs(
+			"      constant = Constant that is used to reserve space for the compressed\n"
+			"        segments.\n"
+			"      type = Method of inserting compressed data:\n"
+			"        before = Overlap the previous segment.\n"
+			"        after  = Insert after the previous segment.\n"
+			"      family = Optional processor family of the segments: 'z80' (the default),\n"
+			"        '68000', or a hexadecimal AS processor family code.\n"
+		, stderr);
+		fputs(
+			"  -f=[address],[constant],[value]\n"
+			"    Write a value of the compressed segments with the specified constant into\n"
+			"    the ROM at the specified address, in big-endian. The value is 'size',\n"
+			"    'start', or 'end' (the address after the data), optionally followed by\n"
+			"    '.b', '.w', or '.l' (the default) for its size. This does the job of\n"
+			"    patching the ROM with the header file.\n"
+		, stderr);
+		fputs(
+			"  -b=[manifest]\n"
+			"    Batch mode: perform every conversion listed in the manifest file, several\n"
+			"    at once. Each line of the manifest holds the options and filenames for\n"
+			"    one conversion, in the same format as the command line.\n"
+		, stderr);
+		fputs(
+			"  -c=[directory]\n"
+			"    Cache compressed data in the specified directory, so that data which has\n"
+			"    not changed since a previous run does not need to be compressed again.\n"
+			"  -d=[filename]\n"
+			"    Read '-z' descriptors ([address],[compression],[constant],[type]) from the\n"
+			"    specified file, one per line. Blank lines and lines starting with '#' are\n"
+			"    ignored.\n"
+		, stderr);
+		fputs(
+			"  -s=[filename]\n"
+			"    Write statistics about the conversion, such as how long each phase took and\n"
+			"    how well each group compressed, to the specified file as JSON.\n"
+			"  -i\n"
+			"    Incremental mode: only write the parts of the output file that changed.\n"
+		, stderr);
+		fputs(
+			"  -u=[filename]\n"
+			"    Also write an IPS patch to the specified file that turns the previous\n"
+			"    contents of the output file into the new ROM.\n"
+			"  -m\n"
+			"    Fill in the ROM end address and checksum in the Mega Drive ROM header.\n"
+			"  -v\n"
+			"    Verify that compressed data is correct, by decompressing it and comparing\n"
+			"    it with the original data. Kosinski+ data cannot be checked, so it is an\n"
+			"    error to use it, and 'auto' does not consider it.\n"
+		, stderr);
+		fputs(
+			"  -n=[filename]\n"
+			"    Planning mode: instead of building a ROM, compress every group and write\n"
+			"    the space that each one needs to the specified file, as '[constant] equ\n"
+			"    $[size]' lines that the assembler can include. Groups that do not fit in\n"
+			"    their reserved space are not an error. The output filename is optional.\n"
+		, stderr);
+		fputs(
+			"  -w\n"
+			"    Watch mode: stay running, and rebuild the ROM whenever the input file\n"
+			"    changes. Compressed data and the ROM are kept in memory between builds,\n"
+			"    so unchanged data is not compressed again, and only the parts of the\n"
+			"    output file that changed are written. Press Ctrl+C to stop.\n"
+			"\n"
+		, stderr);
+		fputs(
+			"This tool converts a Macro Assembler AS '.p' code file to a ROM file.\n"
+			"Consecutive segments starting at a specified address can be compressed in a\n"
+			"specified format, and the size of this compressed data will be written to the\n"
+			"header file.\n"
+			"\n"
+			"An input or output filename of '-' means standard input or standard output.\n"
+		, stderr);
+
+		return EXIT_SUCCESS;
+	}
+
+	/* Skip filename. */
+	--argc; ++argv;
+
+	/* Batch mode. */
+	if (strncmp(argv[0], "-b=", 3) == 0)
+	{
+		if (argc != 1)
+			fputs("Error: '-b' cannot be combined with other arguments.\n", stderr);
+		else if (RunBatch(&argv[0][3]))
+			exit_code = EXIT_SUCCESS;
+
+		return exit_code;
+	}
+
+	InitialiseJob(&job);
+
+	/* Process arguments. */
+	for (; argc != 0; --argc, ++argv)
+		ParseArgument(&job, *argv);
+
+	if (job.watch)
+		RunWatch(&job);
+	else
+		RunJob(&job, 0);
+
+	if (job.success)
+		exit_code = EXIT_SUCCESS;
+
+	DeinitialiseJob(&job);
 
 	return exit_code;
 }
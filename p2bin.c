@@ -0,0 +1,2146 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* Documentation of AS's code file format can be found here:
+   http://john.ccac.rwth-aachen.de:8000/as/as_EN.html#sect_5_1_ */
+
+/* Terminology in this code reflects the above documentation. */
+
+#include "p2bin.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "accurate-kosinski/lib/kosinski-compress.h"
+#include "clownlzss/kosinski.h"
+#include "clownlzss/kosinskiplus.h"
+#include "clownlzss/saxman.h"
+#include "lz_comp2/LZSS.h"
+
+#include "file.h"
+#include "greedy.h"
+#include "thread.h"
+#include "timer.h"
+
+typedef struct Buffer
+{
+	unsigned char *data;
+	size_t capacity;
+	size_t size;
+	size_t position;
+	cc_bool out_of_memory;
+} Buffer;
+
+/* Feeds the compressors that only accept one byte at a time. This is kept as small as possible, since it is called for every byte. */
+typedef struct ByteReader
+{
+	const unsigned char *pointer, *end;
+} ByteReader;
+
+typedef struct CacheEntry
+{
+	struct CacheEntry *next;
+
+	P2Bin_Compression compression;
+	cc_bool fast;
+	unsigned long hash;
+	unsigned char *uncompressed_data;
+	size_t uncompressed_size;
+
+	unsigned char *compressed_data;
+	size_t compressed_size;
+	cc_bool complete;
+	/* Whether a conversion has used this entry since the cache was last trimmed. */
+	cc_bool used;
+
+	/* Held by whichever conversion is producing the compressed data, until it is done. */
+	Thread_Mutex *mutex;
+} CacheEntry;
+
+struct P2Bin_Cache
+{
+	Thread_Mutex *mutex;
+	CacheEntry *entry_list_head;
+};
+
+typedef struct CompressedGroup
+{
+	const P2Bin_CompressedSegment *compressed_segment;
+	const P2Bin_Options *options;
+	P2Bin_Compression compression;
+	/* Whether the greedy compressors are used instead of the normal ones. */
+	cc_bool fast;
+
+	/* With 'P2BIN_COMPRESSION_AUTO', the group is compressed as one of these for each candidate format. */
+	struct CompressedGroup *candidates;
+	size_t total_candidates;
+	/* With Kosinski Moduled, each module is compressed as one of these, and then they are joined together. */
+	struct CompressedGroup *modules;
+	size_t total_modules;
+
+	/* Points into the conversion's arena. */
+	unsigned char *uncompressed_data;
+	size_t uncompressed_size;
+
+	Buffer compressed_data;
+	cc_bool needs_compression;
+	cc_bool compressor_failed;
+	cc_bool verification_failed;
+	cc_bool verification_out_of_memory;
+	cc_bool verified;
+	cc_bool cached;
+	double compression_time;
+
+	/* The entry in the shared cache for this group's data, and whether this group is the one that must fill it in. */
+	CacheEntry *shared_cache_entry;
+	cc_bool owns_shared_cache_entry;
+
+	/* Where the compressed data goes, and what it must not overlap. */
+	cc_bool follows_previous_group;
+	unsigned long address;
+	unsigned long space_available;
+	cc_bool has_following_segment;
+	/* The first of the state's later extents that were written after this group was read. */
+	size_t first_later_extent;
+	cc_bool fits;
+} CompressedGroup;
+
+typedef struct Extent
+{
+	unsigned long start, end;
+} Extent;
+
+typedef struct State
+{
+	const P2Bin_Options *options;
+	const unsigned char *input_pointer, *input_end;
+	Buffer output_buffer;
+	/* Holds the uncompressed data of every group, one after the other. This is
+	   large enough for the whole file up-front, so that it never moves while
+	   groups are being compressed in the background. */
+	Buffer arena;
+	size_t group_start;
+	unsigned long maximum_address;
+	unsigned long last_compressed_segment_end;
+	unsigned long previous_68k_segment_start;
+	unsigned int previous_68k_segment_length;
+	const P2Bin_CompressedSegment *current_compressed_segment;
+	/* The compressed segments, sorted by starting address, with only the last of each address kept. */
+	const P2Bin_CompressedSegment **compressed_segment_index;
+	size_t total_indexed_compressed_segments;
+	/* These are allocated separately, so that they do not move while being compressed. */
+	CompressedGroup **compressed_groups;
+	size_t total_compressed_groups, compressed_groups_capacity;
+	/* Groups are compressed in the background as soon as they are complete, while the rest of the file is read.
+	   This is every group and candidate that has been given to the pipeline. */
+	Thread_Pipeline *pipeline;
+	CompressedGroup **queued_groups;
+	size_t total_queued_groups, queued_groups_capacity;
+	cc_bool output_ends_with_compressed_group;
+	/* The areas of the ROM that were written by segments after the first compressed group, with contiguous areas
+	   merged together. Compressed data is only inserted once the whole file has been read, so these would overwrite
+	   it if it were inserted straight away, which is what used to happen. */
+	Extent *later_extents;
+	size_t total_later_extents, later_extents_capacity;
+	P2Bin_Statistics statistics;
+} State;
+
+static void Error(const P2Bin_Options* const options, const char* const message)
+{
+	if (options->error_callback != NULL)
+		options->error_callback(options->error_callback_user_data, message);
+}
+
+static void ErrorWithConstant(const P2Bin_Options* const options, const char* const format, const char* const constant, const unsigned long value)
+{
+	/* ANSI C lacks 'snprintf', so make sure that the buffer is large enough for the constant and the number. */
+	char* const message = (char*)malloc(strlen(format) + strlen(constant) + 8 * 2 + 1);
+
+	if (message == NULL)
+	{
+		Error(options, "Out of memory.");
+	}
+	else
+	{
+		sprintf(message, format, constant, value);
+		Error(options, message);
+		free(message);
+	}
+}
+
+static void OutOfMemory(const P2Bin_Options* const options)
+{
+	Error(options, "Out of memory.");
+}
+
+static cc_bool InputAvailable(const State* const state, const size_t total_bytes)
+{
+	return (size_t)(state->input_end - state->input_pointer) >= total_bytes;
+}
+
+static cc_bool SegmentAvailable(const State* const state)
+{
+	/* Check for the starting address and length, and then the segment data that the length describes. */
+	return InputAvailable(state, 6) && InputAvailable(state, 6 + (state->input_pointer[4] | (state->input_pointer[5] << 8)));
+}
+
+/* The following functions do not perform bounds checks: the caller must use the above functions first. */
+
+static unsigned int ReadByte(State* const state)
+{
+	return *state->input_pointer++;
+}
+
+static const unsigned char* ReadBytes(State* const state, const unsigned int total_bytes)
+{
+	const unsigned char* const bytes = state->input_pointer;
+
+	state->input_pointer += total_bytes;
+
+	return bytes;
+}
+
+static unsigned long ReadInteger(State* const state, const unsigned int total_bytes)
+{
+	unsigned long value;
+	unsigned int i;
+
+	value = 0;
+
+	for (i = 0; i < total_bytes; ++i)
+		value |= (unsigned long)state->input_pointer[i] << (i * 8);
+
+	state->input_pointer += total_bytes;
+
+	return value;
+}
+
+static unsigned int ReadWord(State* const state)
+{
+	return ReadInteger(state, 2);
+}
+
+static unsigned long ReadLongInt(State* const state)
+{
+	return ReadInteger(state, 4);
+}
+
+static cc_bool Buffer_Reserve(Buffer* const buffer, const size_t size)
+{
+	if (size > buffer->capacity)
+	{
+		/* Grow exponentially, so that many small writes do not cause many reallocations. */
+		const size_t new_capacity = CC_MAX(size, buffer->capacity == 0 ? 0x10000 : buffer->capacity * 2);
+		unsigned char* const new_data = (unsigned char*)realloc(buffer->data, new_capacity);
+
+		if (new_data == NULL)
+		{
+			buffer->out_of_memory = cc_true;
+			return cc_false;
+		}
+
+		buffer->data = new_data;
+		buffer->capacity = new_capacity;
+	}
+
+	return cc_true;
+}
+
+static unsigned char* Buffer_Allocate(Buffer* const buffer, const size_t total_bytes)
+{
+	/* Returns a pointer to 'total_bytes' of space at the current position, and then advances past it. */
+	const size_t end = buffer->position + total_bytes;
+	unsigned char *pointer;
+
+	if (!Buffer_Reserve(buffer, end))
+		return NULL;
+
+	/* Like a file, any gap between the old end and the current position is filled with zeroes. */
+	if (buffer->position > buffer->size)
+		memset(&buffer->data[buffer->size], 0, buffer->position - buffer->size);
+
+	pointer = &buffer->data[buffer->position];
+
+	buffer->position = end;
+
+	if (end > buffer->size)
+		buffer->size = end;
+
+	return pointer;
+}
+
+static void Buffer_Write(Buffer* const buffer, const void* const data, const size_t total_bytes)
+{
+	unsigned char* const pointer = Buffer_Allocate(buffer, total_bytes);
+
+	if (pointer != NULL)
+		memcpy(pointer, data, total_bytes);
+}
+
+static void Buffer_WriteByte(Buffer* const buffer, const unsigned int byte)
+{
+	/* Most of the compressors output one byte at a time, so this is given a fast path
+	   for the common case of there being room at or before the end of the data. */
+	if (buffer->position < buffer->capacity && buffer->position <= buffer->size)
+	{
+		buffer->data[buffer->position++] = (unsigned char)byte;
+
+		if (buffer->position > buffer->size)
+			buffer->size = buffer->position;
+	}
+	else
+	{
+		unsigned char* const pointer = Buffer_Allocate(buffer, 1);
+
+		if (pointer != NULL)
+			*pointer = (unsigned char)byte;
+	}
+}
+
+static void Buffer_Fill(Buffer* const buffer, const unsigned int value, const size_t total_bytes)
+{
+	unsigned char* const pointer = Buffer_Allocate(buffer, total_bytes);
+
+	if (pointer != NULL)
+		memset(pointer, value, total_bytes);
+}
+
+static void Buffer_Seek(Buffer* const buffer, const size_t position)
+{
+	buffer->position = position;
+}
+
+static size_t Buffer_Tell(const Buffer* const buffer)
+{
+	return buffer->position;
+}
+
+static void Buffer_Free(Buffer* const buffer)
+{
+	free(buffer->data);
+}
+
+static void ByteReader_Initialise(ByteReader* const reader, const unsigned char* const data, const size_t size)
+{
+	reader->pointer = data;
+	reader->end = data + size;
+}
+
+static unsigned int AccurateKosinskiCompressCallback_ReadByte(void* const user_data)
+{
+	ByteReader* const reader = (ByteReader*)user_data;
+
+	return reader->pointer == reader->end ? (unsigned int)-1 : *reader->pointer++;
+}
+
+static void AccurateKosinskiCompressCallback_WriteByte(void* const user_data, const unsigned int byte)
+{
+	Buffer_WriteByte((Buffer*)user_data, byte);
+}
+
+static void ClownLZSSCallback_Write(void* const user_data, const unsigned char byte)
+{
+	Buffer_WriteByte((Buffer*)user_data, byte);
+}
+
+static void ClownLZSSCallback_Seek(void* const user_data, const size_t position)
+{
+	Buffer_Seek((Buffer*)user_data, position);
+}
+
+static size_t ClownLZSSCallback_Tell(void* const user_data)
+{
+	return Buffer_Tell((Buffer*)user_data);
+}
+
+static void BlockCallback_Write(void* const user_data, const unsigned char* const bytes, const size_t total_bytes)
+{
+	/* For the compressors that output a block at a time. */
+	Buffer_Write((Buffer*)user_data, bytes, total_bytes);
+}
+
+static int LZSS_ReadByte(void* const user_data)
+{
+	ByteReader* const reader = (ByteReader*)user_data;
+
+	return reader->pointer == reader->end ? EOF : *reader->pointer++;
+}
+
+static void LZSS_WriteByte(void* const user_data, const int byte)
+{
+	Buffer_WriteByte((Buffer*)user_data, byte);
+}
+
+typedef struct KosinskiReader
+{
+	ByteReader bytes;
+	unsigned int descriptor;
+	unsigned int descriptor_bits_remaining;
+} KosinskiReader;
+
+static cc_bool KosinskiReader_ReadDescriptor(KosinskiReader* const reader)
+{
+	/* The end of the data may be reached here, as the next descriptor is read as soon as the previous one runs out,
+	   even if the data ends before another bit is needed. */
+	if (reader->bytes.end - reader->bytes.pointer < 2)
+	{
+		reader->descriptor_bits_remaining = 0;
+		return cc_false;
+	}
+
+	reader->descriptor = reader->bytes.pointer[0] | (unsigned int)reader->bytes.pointer[1] << 8;
+	reader->descriptor_bits_remaining = 16;
+	reader->bytes.pointer += 2;
+	return cc_true;
+}
+
+static cc_bool KosinskiReader_ReadBit(KosinskiReader* const reader, unsigned int* const bit)
+{
+	if (reader->descriptor_bits_remaining == 0)
+		return cc_false;
+
+	*bit = reader->descriptor & 1;
+	reader->descriptor >>= 1;
+
+	if (--reader->descriptor_bits_remaining == 0)
+		KosinskiReader_ReadDescriptor(reader);
+
+	return cc_true;
+}
+
+static cc_bool KosinskiReader_ReadByte(KosinskiReader* const reader, unsigned int* const byte)
+{
+	if (reader->bytes.pointer == reader->bytes.end)
+		return cc_false;
+
+	*byte = *reader->bytes.pointer++;
+	return cc_true;
+}
+
+static cc_bool KosinskiDecompress(const unsigned char* const data, const size_t size, Buffer* const output, size_t* const compressed_size)
+{
+	/* Used to check the output of the Kosinski compressors. Returns false if the data is malformed.
+	   'compressed_size' is set to how much of the data was used. */
+	KosinskiReader reader;
+
+	ByteReader_Initialise(&reader.bytes, data, size);
+
+	if (!KosinskiReader_ReadDescriptor(&reader))
+		return cc_false;
+
+	for (;;)
+	{
+		unsigned int bit, byte, distance, count;
+
+		if (!KosinskiReader_ReadBit(&reader, &bit))
+			return cc_false;
+
+		if (bit != 0)
+		{
+			/* Literal. */
+			if (!KosinskiReader_ReadByte(&reader, &byte))
+				return cc_false;
+
+			Buffer_WriteByte(output, byte);
+			continue;
+		}
+
+		if (!KosinskiReader_ReadBit(&reader, &bit))
+			return cc_false;
+
+		if (bit == 0)
+		{
+			/* Inline match: a two-bit count and an 8-bit offset. */
+			unsigned int low_bit;
+
+			if (!KosinskiReader_ReadBit(&reader, &bit) || !KosinskiReader_ReadBit(&reader, &low_bit) || !KosinskiReader_ReadByte(&reader, &byte))
+				return cc_false;
+
+			count = (bit << 1 | low_bit) + 2;
+			distance = 0x100 - byte;
+		}
+		else
+		{
+			/* Full match: a 13-bit offset, and a 3-bit count, or an 8-bit count in a third byte. */
+			unsigned int high_byte;
+
+			if (!KosinskiReader_ReadByte(&reader, &byte) || !KosinskiReader_ReadByte(&reader, &high_byte))
+				return cc_false;
+
+			distance = 0x2000 - ((high_byte & 0xF8) << 5 | byte);
+			count = high_byte & 7;
+
+			if (count != 0)
+			{
+				count += 2;
+			}
+			else
+			{
+				if (!KosinskiReader_ReadByte(&reader, &count))
+					return cc_false;
+
+				if (count == 0)
+				{
+					/* End of data. */
+					*compressed_size = reader.bytes.pointer - data;
+					return cc_true;
+				}
+				else if (count == 1)
+					continue; /* Nothing. */
+
+				count += 1;
+			}
+		}
+
+		if (distance > output->size)
+			return cc_false;
+
+		/* The match may overlap the data that it produces, so it must be copied one byte at a time. */
+		while (count-- != 0 && !output->out_of_memory)
+			Buffer_WriteByte(output, output->data[output->size - distance]);
+	}
+}
+
+static void VerifyGroup(CompressedGroup* const group)
+{
+	/* This is done on a worker thread straight after the group is compressed, so it must only write to its own flags. */
+	const unsigned char* const compressed_data = group->compressed_data.data;
+	const size_t compressed_size = group->compressed_data.size;
+	Buffer decompressed;
+
+	if (group->verified)
+		return;
+
+	group->verified = cc_true;
+
+	/* These errors are reported without needing to check anything. */
+	if (group->compressor_failed || group->compressed_data.out_of_memory || group->verification_failed)
+		return;
+
+	memset(&decompressed, 0, sizeof(decompressed));
+
+	if (!Buffer_Reserve(&decompressed, group->uncompressed_size))
+	{
+		group->verification_out_of_memory = cc_true;
+		return;
+	}
+
+	switch (group->compression)
+	{
+		case P2BIN_COMPRESSION_UNCOMPRESSED:
+			Buffer_Write(&decompressed, compressed_data, compressed_size);
+			break;
+
+		case P2BIN_COMPRESSION_KOSINSKI:
+		case P2BIN_COMPRESSION_KOSINSKI_OPTIMISED:
+		{
+			size_t used_size;
+
+			if (!KosinskiDecompress(compressed_data, compressed_size, &decompressed, &used_size))
+				group->verification_failed = cc_true;
+
+			break;
+		}
+
+		case P2BIN_COMPRESSION_SAXMAN:
+		case P2BIN_COMPRESSION_SAXMAN_BUGGED:
+		case P2BIN_COMPRESSION_SAXMAN_OPTIMISED:
+		{
+			/* This is too large to put on the stack. */
+			LZSS_State* const lzss_state = (LZSS_State*)malloc(sizeof(LZSS_State));
+			ByteReader reader;
+
+			if (lzss_state == NULL)
+			{
+				decompressed.out_of_memory = cc_true;
+				break;
+			}
+
+			/* The garbage byte at the end of bugged data does not produce anything here, as the data stops before the match that it describes. */
+			ByteReader_Initialise(&reader, compressed_data, compressed_size);
+			LZSS_Decode(lzss_state, LZSS_ReadByte, &reader, LZSS_WriteByte, &decompressed);
+
+			free(lzss_state);
+			break;
+		}
+
+		case P2BIN_COMPRESSION_KOSINSKI_MODULED:
+		case P2BIN_COMPRESSION_KOSINSKI_MODULED_OPTIMISED:
+		case P2BIN_COMPRESSION_AUTO:
+			/* Only the modules and the candidates are compressed, so they are what gets verified. */
+		case P2BIN_COMPRESSION_KOSINSKIPLUS:
+			/* There is no Kosinski+ decompressor, so Kosinski+ is refused before it gets here. */
+			Buffer_Free(&decompressed);
+			return;
+	}
+
+	if (decompressed.out_of_memory)
+		group->verification_out_of_memory = cc_true;
+	else if (decompressed.size != group->uncompressed_size || memcmp(decompressed.data, group->uncompressed_data, decompressed.size) != 0)
+		group->verification_failed = cc_true;
+
+	Buffer_Free(&decompressed);
+}
+
+static void NotEnoughSpace(const State* const state, const P2Bin_CompressedSegment* const compressed_segment, const unsigned long compressed_size)
+{
+	ErrorWithConstant(state->options, "Space reserved for the compressed segments is too small. Set '%s' to at least $%lX.", compressed_segment->constant, compressed_size);
+}
+
+#define HASH_INITIAL_VALUE 0x811C9DC5
+
+static unsigned long HashBytes(unsigned long hash, const unsigned char* const data, const size_t size)
+{
+	/* 32-bit FNV-1a. */
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		hash = ((hash ^ data[i]) * 0x01000193) & 0xFFFFFFFF;
+
+	return hash;
+}
+
+static unsigned long HashGroup(const CompressedGroup* const group)
+{
+	/* This only needs to be good enough to name files: a cache hit is confirmed by comparing the data itself. */
+	unsigned char format[2];
+
+	format[0] = group->compression;
+	format[1] = group->fast;
+
+	return HashBytes(HashBytes(HASH_INITIAL_VALUE, format, sizeof(format)), group->uncompressed_data, group->uncompressed_size);
+}
+
+static char* GetCacheFilename(const CompressedGroup* const group, const char* const extension)
+{
+	const char* const cache_directory = group->options->cache_directory;
+	char* const filename = (char*)malloc(strlen(cache_directory) + 1 + 8 + 1 + 3 + 5 + 1 + strlen(extension) + 1);
+
+	if (filename != NULL)
+		sprintf(filename, "%s/%08lX-%u%s.%s", cache_directory, HashGroup(group), (unsigned int)group->compression, group->fast ? "-fast" : "", extension);
+
+	return filename;
+}
+
+/* Cache files contain a version byte, then the size of the uncompressed data,
+   the size of the compressed data, and a hash of the compressed data, each as
+   a 32-bit little-endian integer, and then the uncompressed data itself,
+   followed by the compressed data. The uncompressed data is there so that hash
+   collisions can be detected, and the size and hash of the compressed data are
+   there so that a truncated or corrupted file is not put into the ROM. */
+
+#define CACHE_VERSION 2
+#define CACHE_HEADER_SIZE 13
+
+static unsigned long ReadCacheInteger(const unsigned char* const bytes)
+{
+	return bytes[0] | ((unsigned long)bytes[1] << 8) | ((unsigned long)bytes[2] << 16) | ((unsigned long)bytes[3] << 24);
+}
+
+static void WriteCacheInteger(unsigned char* const bytes, const unsigned long value)
+{
+	bytes[0] = (value >> (8 * 0)) & 0xFF;
+	bytes[1] = (value >> (8 * 1)) & 0xFF;
+	bytes[2] = (value >> (8 * 2)) & 0xFF;
+	bytes[3] = (value >> (8 * 3)) & 0xFF;
+}
+
+static cc_bool LoadGroupFromCache(CompressedGroup* const group)
+{
+	cc_bool success = cc_false;
+	char* const filename = GetCacheFilename(group, "bin");
+
+	if (filename != NULL)
+	{
+		FILE* const file = fopen(filename, "rb");
+
+		if (file != NULL)
+		{
+			size_t size;
+			unsigned char* const contents = File_ReadWhole(file, &size);
+
+			fclose(file);
+
+			if (contents != NULL)
+			{
+				/* The compressed data follows the uncompressed data. */
+				const size_t compressed_start = CACHE_HEADER_SIZE + group->uncompressed_size;
+
+				if (size >= compressed_start
+				 && contents[0] == CACHE_VERSION
+				 && ReadCacheInteger(&contents[1]) == group->uncompressed_size
+				 && ReadCacheInteger(&contents[5]) == size - compressed_start
+				 && ReadCacheInteger(&contents[9]) == HashBytes(HASH_INITIAL_VALUE, &contents[compressed_start], size - compressed_start)
+				 && memcmp(&contents[CACHE_HEADER_SIZE], group->uncompressed_data, group->uncompressed_size) == 0)
+				{
+					Buffer_Write(&group->compressed_data, &contents[compressed_start], size - compressed_start);
+
+					success = !group->compressed_data.out_of_memory;
+				}
+
+				free(contents);
+			}
+		}
+
+		free(filename);
+	}
+
+	return success;
+}
+
+static void SaveGroupToCache(const CompressedGroup* const group)
+{
+	/* Failing to update the cache is not an error: it just means that we will have to compress the data again next time. */
+	char temporary_extension[0x30];
+	char *filename, *temporary_filename;
+
+	/* The temporary file is named after this process and this group, so that other processes and
+	   other groups with the same data that are sharing the cache directory cannot write to it too. */
+	sprintf(temporary_extension, "%lX-%lX.tmp", File_GetProcessID(), (unsigned long)(size_t)group);
+
+	filename = GetCacheFilename(group, "bin");
+	temporary_filename = GetCacheFilename(group, temporary_extension);
+
+	if (filename != NULL && temporary_filename != NULL)
+	{
+		/* Write to a temporary file first, so that a partially-written file is never mistaken for a valid one. */
+		FILE* const file = fopen(temporary_filename, "wb");
+
+		if (file != NULL)
+		{
+			unsigned char header[CACHE_HEADER_SIZE];
+			cc_bool success;
+
+			header[0] = CACHE_VERSION;
+			WriteCacheInteger(&header[1], group->uncompressed_size);
+			WriteCacheInteger(&header[5], group->compressed_data.size);
+			WriteCacheInteger(&header[9], HashBytes(HASH_INITIAL_VALUE, group->compressed_data.data, group->compressed_data.size));
+
+			success = fwrite(header, 1, sizeof(header), file) == sizeof(header)
+			       && fwrite(group->uncompressed_data, 1, group->uncompressed_size, file) == group->uncompressed_size
+			       && fwrite(group->compressed_data.data, 1, group->compressed_data.size, file) == group->compressed_data.size;
+
+			if (fclose(file) != 0)
+				success = cc_false;
+
+			/* 'rename' will not replace an existing file on some platforms. */
+			remove(filename);
+
+			if (!success || rename(temporary_filename, filename) != 0)
+				remove(temporary_filename);
+		}
+	}
+
+	free(filename);
+	free(temporary_filename);
+}
+
+static void CompressGroup(CompressedGroup* const group)
+{
+	/* This is called on a worker thread, so it must not touch anything other than its own group. */
+	Buffer* const output = &group->compressed_data;
+	ClownLZSS_Callbacks clownlzss_callbacks;
+	double start_time;
+
+	if (!group->needs_compression)
+		return;
+
+	start_time = Timer_GetSeconds();
+
+	group->needs_compression = cc_false;
+
+	/* Compressed data is rarely much larger than the uncompressed data, so reserve
+	   enough space for that up-front to avoid reallocating during compression. */
+	Buffer_Reserve(output, group->uncompressed_size + group->uncompressed_size / 8 + 0x20);
+
+	clownlzss_callbacks.user_data = output;
+	clownlzss_callbacks.write = ClownLZSSCallback_Write;
+	clownlzss_callbacks.seek = ClownLZSSCallback_Seek;
+	clownlzss_callbacks.tell = ClownLZSSCallback_Tell;
+
+	switch (group->compression)
+	{
+		case P2BIN_COMPRESSION_UNCOMPRESSED:
+			Buffer_Write(output, group->uncompressed_data, group->uncompressed_size);
+			break;
+
+		case P2BIN_COMPRESSION_KOSINSKI:
+		case P2BIN_COMPRESSION_KOSINSKI_OPTIMISED:
+			if (group->fast)
+			{
+				/* Unlike the authentic compressor, this one is thread-safe. */
+				group->compressor_failed = !Greedy_KosinskiCompress(group->uncompressed_data, group->uncompressed_size, BlockCallback_Write, output);
+
+				/* Kosinski-compressed data is always padded to 0x10 bytes. */
+				Buffer_Fill(output, 0, -Buffer_Tell(output) & 0xF);
+			}
+			else if (group->compression == P2BIN_COMPRESSION_KOSINSKI)
+			{
+				KosinskiCompressCallbacks callbacks;
+				ByteReader reader;
+
+				/* The accurate Kosinski compressor can only read its input one byte at a time. */
+				ByteReader_Initialise(&reader, group->uncompressed_data, group->uncompressed_size);
+
+				callbacks.read_byte_user_data = &reader;
+				callbacks.read_byte = AccurateKosinskiCompressCallback_ReadByte;
+				callbacks.write_byte_user_data = output;
+				callbacks.write_byte = AccurateKosinskiCompressCallback_WriteByte;
+
+				/* This compressor is not thread-safe. */
+				Thread_Lock();
+				KosinskiCompress(&callbacks, cc_false);
+				Thread_Unlock();
+
+				/* Kosinski-compressed data is always padded to 0x10 bytes. */
+				Buffer_Fill(output, 0, -Buffer_Tell(output) & 0xF);
+			}
+			else
+			{
+				group->compressor_failed = !ClownLZSS_KosinskiCompress(group->uncompressed_data, group->uncompressed_size, &clownlzss_callbacks);
+			}
+
+			break;
+
+		case P2BIN_COMPRESSION_SAXMAN:
+		case P2BIN_COMPRESSION_SAXMAN_BUGGED:
+		case P2BIN_COMPRESSION_SAXMAN_OPTIMISED:
+			if (group->fast)
+			{
+				group->compressor_failed = !Greedy_SaxmanCompress(group->uncompressed_data, group->uncompressed_size, BlockCallback_Write, output);
+			}
+			else if (group->compression == P2BIN_COMPRESSION_SAXMAN_OPTIMISED)
+			{
+				group->compressor_failed = !ClownLZSS_SaxmanCompressWithoutHeader(group->uncompressed_data, group->uncompressed_size, &clownlzss_callbacks);
+			}
+			else
+			{
+				/* This is too large to put on the stack. */
+				LZSS_State* const lzss_state = (LZSS_State*)malloc(sizeof(LZSS_State));
+
+				if (lzss_state == NULL)
+				{
+					group->compressor_failed = cc_true;
+					break;
+				}
+
+				LZSS_Encode(lzss_state, group->uncompressed_data, group->uncompressed_size, BlockCallback_Write, output);
+
+				if (group->options->verify)
+				{
+					/* Check that the faster match finder produced the same data as the original one. */
+					Buffer reference;
+
+					memset(&reference, 0, sizeof(reference));
+
+					LZSS_EncodeReference(lzss_state, group->uncompressed_data, group->uncompressed_size, BlockCallback_Write, &reference);
+
+					if (reference.out_of_memory)
+						output->out_of_memory = cc_true;
+					else if (reference.size != output->size || memcmp(reference.data, output->data, reference.size) != 0)
+						group->verification_failed = cc_true;
+
+					Buffer_Free(&reference);
+				}
+
+				free(lzss_state);
+			}
+
+			if (group->compression == P2BIN_COMPRESSION_SAXMAN_BUGGED)
+			{
+				/* Insert a dumb garbage byte depending on if the compressed data is an
+				   odd or even number of bytes long. This garbage byte is processed by
+				   the decompressor, causing garbage data to be generated past the end
+				   of the decompressed data. */
+				/*
+				https://forums.sonicretro.org/index.php?threads/the-mystery-of-sonic-2s-subtly-broken-sound-driver-compression.41804/
+				https://sonicresearch.org/community/index.php?threads/the-mystery-of-sonic-2s-subtly-broken-sound-driver-compression.6772/
+				https://clownacy.wordpress.com/2023/06/07/the-mystery-of-sonic-2s-subtly-broken-sound-driver-compression/
+				*/
+				const int garbage_byte = Buffer_Tell(output) % 2 != 0 ? 0x4E : 0x00;
+				Buffer_WriteByte(output, garbage_byte);
+			}
+
+			break;
+
+		case P2BIN_COMPRESSION_KOSINSKIPLUS:
+			group->compressor_failed = !ClownLZSS_KosinskiPlusCompress(group->uncompressed_data, group->uncompressed_size, &clownlzss_callbacks);
+			break;
+
+		case P2BIN_COMPRESSION_KOSINSKI_MODULED:
+		case P2BIN_COMPRESSION_KOSINSKI_MODULED_OPTIMISED:
+			/* The modules are compressed instead. */
+			break;
+
+		case P2BIN_COMPRESSION_AUTO:
+			/* The candidates are compressed instead. */
+			break;
+	}
+
+	group->compression_time = Timer_GetSeconds() - start_time;
+}
+
+static void CompressGroupJob(void* const user_data, void* const job)
+{
+	CompressedGroup* const group = (CompressedGroup*)job;
+
+	(void)user_data;
+
+	CompressGroup(group);
+
+	/* Verifying here hides its cost behind the parsing and the compression of the other groups. */
+	if (group->options->verify)
+		VerifyGroup(group);
+}
+
+static CacheEntry* CreateSharedCacheEntry(const CompressedGroup* const group, const unsigned long hash)
+{
+	/* The new entry's mutex is returned locked. Returns NULL on failure. */
+	CacheEntry* const entry = (CacheEntry*)malloc(sizeof(CacheEntry));
+
+	if (entry != NULL)
+	{
+		entry->next = NULL;
+		entry->compression = group->compression;
+		entry->fast = group->fast;
+		entry->hash = hash;
+		entry->uncompressed_data = (unsigned char*)malloc(group->uncompressed_size + 1);
+		entry->uncompressed_size = group->uncompressed_size;
+		entry->compressed_data = NULL;
+		entry->compressed_size = 0;
+		entry->complete = cc_false;
+		entry->used = cc_true;
+		entry->mutex = Thread_CreateMutex();
+
+		if (entry->uncompressed_data == NULL || entry->mutex == NULL)
+		{
+			free(entry->uncompressed_data);
+
+			if (entry->mutex != NULL)
+				Thread_DestroyMutex(entry->mutex);
+
+			free(entry);
+			return NULL;
+		}
+
+		memcpy(entry->uncompressed_data, group->uncompressed_data, group->uncompressed_size);
+		Thread_LockMutex(entry->mutex);
+	}
+
+	return entry;
+}
+
+static void DestroySharedCacheEntry(CacheEntry* const entry)
+{
+	Thread_DestroyMutex(entry->mutex);
+	free(entry->uncompressed_data);
+	free(entry->compressed_data);
+	free(entry);
+}
+
+static void ClaimSharedCacheEntry(P2Bin_Cache* const cache, CompressedGroup* const group)
+{
+	/* Either find the entry for this group's data, or create one and take ownership of it.
+	   A new entry's mutex is locked until the owner has compressed the data, so that other
+	   conversions can wait for it. Waiting is only done after every owned entry has been
+	   filled-in, so that two conversions can never end up waiting on each other. */
+	/* The new entry is prepared before the cache's mutex is taken, so that an entry's mutex
+	   is never locked while holding the cache's mutex. Owners lock the cache's mutex while
+	   holding their entries' mutexes, so doing it the other way around would risk deadlock. */
+	const unsigned long hash = HashGroup(group);
+	/* If this fails, then the group is simply compressed without being shared. */
+	CacheEntry *new_entry = CreateSharedCacheEntry(group, hash);
+	CacheEntry *entry;
+
+	Thread_LockMutex(cache->mutex);
+
+	for (entry = cache->entry_list_head; entry != NULL; entry = entry->next)
+		if (entry->hash == hash
+		 && entry->compression == group->compression
+		 && entry->fast == group->fast
+		 && entry->uncompressed_size == group->uncompressed_size
+		 && memcmp(entry->uncompressed_data, group->uncompressed_data, group->uncompressed_size) == 0)
+			break;
+
+	if (entry != NULL)
+	{
+		entry->used = cc_true;
+
+		group->shared_cache_entry = entry;
+		group->owns_shared_cache_entry = cc_false;
+	}
+	else if (new_entry != NULL)
+	{
+		new_entry->next = cache->entry_list_head;
+		cache->entry_list_head = new_entry;
+
+		group->shared_cache_entry = new_entry;
+		group->owns_shared_cache_entry = cc_true;
+
+		new_entry = NULL;
+	}
+
+	Thread_UnlockMutex(cache->mutex);
+
+	/* Discard the new entry if it turned out to be unneeded. */
+	if (new_entry != NULL)
+	{
+		Thread_UnlockMutex(new_entry->mutex);
+		DestroySharedCacheEntry(new_entry);
+	}
+}
+
+static void PublishSharedCacheEntry(CompressedGroup* const group)
+{
+	CacheEntry* const entry = group->shared_cache_entry;
+
+	if (!group->compressor_failed && !group->compressed_data.out_of_memory)
+	{
+		entry->compressed_data = (unsigned char*)malloc(group->compressed_data.size + 1);
+
+		if (entry->compressed_data != NULL)
+		{
+			memcpy(entry->compressed_data, group->compressed_data.data, group->compressed_data.size);
+			entry->compressed_size = group->compressed_data.size;
+			entry->complete = cc_true;
+		}
+	}
+
+	Thread_UnlockMutex(entry->mutex);
+}
+
+static void CollectSharedCacheEntry(CompressedGroup* const group)
+{
+	CacheEntry* const entry = group->shared_cache_entry;
+
+	/* Wait for the owner to finish with the entry. */
+	Thread_LockMutex(entry->mutex);
+
+	/* If the owner failed to compress the data, then try compressing it here instead. */
+	if (entry->complete)
+	{
+		Buffer_Write(&group->compressed_data, entry->compressed_data, entry->compressed_size);
+		group->cached = cc_true;
+	}
+	else
+		group->needs_compression = cc_true;
+
+	Thread_UnlockMutex(entry->mutex);
+}
+
+static cc_bool CreateCandidates(State* const state, CompressedGroup* const group)
+{
+	/* Make a copy of the group for every candidate format, so that they can all be compressed at once, like separate groups. */
+	unsigned int candidate_compressions = group->compressed_segment->candidate_compressions != 0 ? group->compressed_segment->candidate_compressions : P2BIN_COMPRESSION_DEFAULT_CANDIDATES;
+	unsigned int compression;
+
+	/* Kosinski+ data cannot be verified, so it is not a candidate when the data must be. */
+	if (state->options->verify)
+	{
+		candidate_compressions &= ~P2BIN_COMPRESSION_FLAG(P2BIN_COMPRESSION_KOSINSKIPLUS);
+
+		if (candidate_compressions == 0)
+		{
+			ErrorWithConstant(state->options, "'%s' cannot be verified, as Kosinski+ is its only candidate compression format and there is no Kosinski+ decompressor.", group->compressed_segment->constant, 0);
+			return cc_false;
+		}
+	}
+
+	for (compression = 0; compression < P2BIN_COMPRESSION_AUTO; ++compression)
+		if ((candidate_compressions & P2BIN_COMPRESSION_FLAG(compression)) != 0)
+			++group->total_candidates;
+
+	if (group->total_candidates == 0)
+	{
+		ErrorWithConstant(state->options, "No candidate compression formats were given for '%s'.", group->compressed_segment->constant, 0);
+		return cc_false;
+	}
+
+	group->candidates = (CompressedGroup*)malloc(sizeof(CompressedGroup) * group->total_candidates);
+
+	if (group->candidates == NULL)
+	{
+		group->total_candidates = 0;
+		OutOfMemory(state->options);
+		return cc_false;
+	}
+
+	group->total_candidates = 0;
+
+	for (compression = 0; compression < P2BIN_COMPRESSION_AUTO; ++compression)
+	{
+		if ((candidate_compressions & P2BIN_COMPRESSION_FLAG(compression)) != 0)
+		{
+			CompressedGroup* const candidate = &group->candidates[group->total_candidates++];
+
+			*candidate = *group;
+			candidate->compression = (P2Bin_Compression)compression;
+			candidate->candidates = NULL;
+			candidate->total_candidates = 0;
+		}
+	}
+
+	return cc_true;
+}
+
+static cc_bool CreateModules(State* const state, CompressedGroup* const group)
+{
+	/* Make a copy of the group for every module, so that they can all be compressed at once, like separate groups. */
+	const size_t module_size = 0x1000;
+	size_t i;
+
+	/* The size has to fit in the header. */
+	if (group->uncompressed_size > 0xFFFF)
+	{
+		ErrorWithConstant(state->options, "'%s' is too large for Kosinski Moduled ($%lX bytes).", group->compressed_segment->constant, group->uncompressed_size);
+		return cc_false;
+	}
+
+	/* Even empty data has a module. */
+	group->total_modules = group->uncompressed_size == 0 ? 1 : (group->uncompressed_size + module_size - 1) / module_size;
+	group->modules = (CompressedGroup*)malloc(sizeof(CompressedGroup) * group->total_modules);
+
+	if (group->modules == NULL)
+	{
+		group->total_modules = 0;
+		OutOfMemory(state->options);
+		return cc_false;
+	}
+
+	for (i = 0; i < group->total_modules; ++i)
+	{
+		CompressedGroup* const module = &group->modules[i];
+		const size_t offset = i * module_size;
+
+		*module = *group;
+		module->compression = group->compression == P2BIN_COMPRESSION_KOSINSKI_MODULED ? P2BIN_COMPRESSION_KOSINSKI : P2BIN_COMPRESSION_KOSINSKI_OPTIMISED;
+		module->modules = NULL;
+		module->total_modules = 0;
+		module->uncompressed_data = &group->uncompressed_data[offset];
+		module->uncompressed_size = CC_MIN(module_size, group->uncompressed_size - offset);
+	}
+
+	return cc_true;
+}
+
+static void JoinModules(CompressedGroup* const group)
+{
+	/* Kosinski Moduled data is a big-endian word of the uncompressed size, followed by every module, each padded to 0x10 bytes except the last. */
+	Buffer* const output = &group->compressed_data;
+	size_t i;
+
+	group->cached = cc_true;
+
+	Buffer_WriteByte(output, group->uncompressed_size >> 8 & 0xFF);
+	Buffer_WriteByte(output, group->uncompressed_size >> 0 & 0xFF);
+
+	for (i = 0; i < group->total_modules; ++i)
+	{
+		const CompressedGroup* const module = &group->modules[i];
+
+		if (module->compressor_failed)
+			group->compressor_failed = cc_true;
+
+		if (module->compressed_data.out_of_memory)
+			group->compressed_data.out_of_memory = cc_true;
+
+		if (module->verification_failed)
+			group->verification_failed = cc_true;
+
+		if (module->verification_out_of_memory)
+			group->verification_out_of_memory = cc_true;
+
+		if (!module->cached)
+			group->cached = cc_false;
+
+		group->compression_time += module->compression_time;
+
+		if (module->compressed_data.size != 0)
+			Buffer_Write(output, module->compressed_data.data, module->compressed_data.size);
+
+		if (i != group->total_modules - 1)
+			Buffer_Fill(output, 0, -(Buffer_Tell(output) - 2) & 0xF);
+	}
+}
+
+static cc_bool QueueCompression(State* const state, CompressedGroup* const group)
+{
+	size_t i;
+
+	/* Each module is compressed on its own. */
+	if (group->compression == P2BIN_COMPRESSION_KOSINSKI_MODULED || group->compression == P2BIN_COMPRESSION_KOSINSKI_MODULED_OPTIMISED)
+	{
+		if (!CreateModules(state, group))
+			return cc_false;
+
+		for (i = 0; i < group->total_modules; ++i)
+			if (!QueueCompression(state, &group->modules[i]))
+				return cc_false;
+
+		return cc_true;
+	}
+
+	/* Remember the group before anything is claimed for it, so that it is always cleaned-up after. */
+	if (state->total_queued_groups == state->queued_groups_capacity)
+	{
+		const size_t new_capacity = state->queued_groups_capacity == 0 ? 4 : state->queued_groups_capacity * 2;
+		CompressedGroup** const new_queued_groups = (CompressedGroup**)realloc(state->queued_groups, sizeof(CompressedGroup*) * new_capacity);
+
+		if (new_queued_groups == NULL)
+		{
+			OutOfMemory(state->options);
+			return cc_false;
+		}
+
+		state->queued_groups = new_queued_groups;
+		state->queued_groups_capacity = new_capacity;
+	}
+
+	state->queued_groups[state->total_queued_groups++] = group;
+
+	group->needs_compression = cc_true;
+
+	/* If another conversion is already producing this group's data, then there is no need to compress it here. */
+	if (state->options->cache != NULL)
+	{
+		ClaimSharedCacheEntry(state->options->cache, group);
+
+		if (group->shared_cache_entry != NULL && !group->owns_shared_cache_entry)
+			group->needs_compression = cc_false;
+	}
+
+	/* The cache is only accessed from this thread, so that groups with identical data do not fight over the same file. */
+	if (state->options->cache_directory != NULL && group->needs_compression)
+		group->cached = LoadGroupFromCache(group);
+
+	if (group->cached)
+		group->needs_compression = cc_false;
+
+	/* Cached data is verified in the background too. */
+	if (group->needs_compression || (group->cached && state->options->verify))
+		Thread_AddJob(state->pipeline, group);
+
+	return cc_true;
+}
+
+static cc_bool QueueCompressedGroup(State* const state, CompressedGroup* const group)
+{
+	/* Start compressing the group straight away, while the rest of the file is read. */
+	size_t i;
+
+	if (state->pipeline == NULL)
+	{
+		state->pipeline = Thread_StartPipeline(CompressGroupJob, NULL, state->options->total_threads);
+
+		if (state->pipeline == NULL)
+		{
+			OutOfMemory(state->options);
+			return cc_false;
+		}
+	}
+
+	if (group->compression == P2BIN_COMPRESSION_KOSINSKIPLUS && state->options->verify)
+	{
+		/* Silently skipping it would make it look like it was checked. */
+		ErrorWithConstant(state->options, "'%s' cannot be verified, as there is no Kosinski+ decompressor. Use another format, or do not use '-v'.", group->compressed_segment->constant, 0);
+		return cc_false;
+	}
+
+	if (group->compression != P2BIN_COMPRESSION_AUTO)
+		return QueueCompression(state, group);
+
+	if (!CreateCandidates(state, group))
+		return cc_false;
+
+	for (i = 0; i < group->total_candidates; ++i)
+		if (!QueueCompression(state, &group->candidates[i]))
+			return cc_false;
+
+	return cc_true;
+}
+
+static void FinishCompression(State* const state)
+{
+	/* Wait for the background compression to finish, and then save and share the results.
+	   This must be done even if the conversion fails, as other conversions may be waiting
+	   for the shared cache entries that this one owns. */
+	const cc_bool use_cache = state->options->cache_directory != NULL;
+	size_t i;
+
+	if (state->pipeline == NULL)
+		return;
+
+	Thread_FinishPipeline(state->pipeline);
+	state->pipeline = NULL;
+
+	for (i = 0; i < state->total_queued_groups; ++i)
+	{
+		CompressedGroup* const group = state->queued_groups[i];
+
+		if (group->shared_cache_entry == NULL || group->owns_shared_cache_entry)
+			if (use_cache && !group->cached && !group->compressor_failed && !group->compressed_data.out_of_memory)
+				SaveGroupToCache(group);
+
+		if (group->owns_shared_cache_entry)
+			PublishSharedCacheEntry(group);
+	}
+}
+
+static cc_bool FinishCompressedGroup(State* const state)
+{
+	/* Take the segments that have been gathered so far and start compressing them. */
+	if (state->current_compressed_segment != NULL)
+	{
+		CompressedGroup *group;
+
+		if (state->total_compressed_groups == state->compressed_groups_capacity)
+		{
+			const size_t new_capacity = state->compressed_groups_capacity == 0 ? 4 : state->compressed_groups_capacity * 2;
+			CompressedGroup** const new_groups = (CompressedGroup**)realloc(state->compressed_groups, sizeof(CompressedGroup*) * new_capacity);
+
+			if (new_groups == NULL)
+			{
+				OutOfMemory(state->options);
+				return cc_false;
+			}
+
+			state->compressed_groups = new_groups;
+			state->compressed_groups_capacity = new_capacity;
+		}
+
+		group = (CompressedGroup*)malloc(sizeof(CompressedGroup));
+
+		if (group == NULL)
+		{
+			OutOfMemory(state->options);
+			return cc_false;
+		}
+
+		state->compressed_groups[state->total_compressed_groups++] = group;
+
+		memset(group, 0, sizeof(*group));
+		group->compressed_segment = state->current_compressed_segment;
+		group->options = state->options;
+		group->compression = state->current_compressed_segment->compression;
+		group->fast = state->current_compressed_segment->fast;
+		group->uncompressed_data = &state->arena.data[state->group_start];
+		group->uncompressed_size = Buffer_Tell(&state->arena) - state->group_start;
+		group->first_later_extent = state->total_later_extents;
+
+		if (state->current_compressed_segment->type == P2BIN_TYPE_BEFORE)
+		{
+			/* Overwrite the previous segment. */
+			group->address = state->previous_68k_segment_start;
+			group->space_available = state->previous_68k_segment_length;
+		}
+		else if (state->output_ends_with_compressed_group)
+		{
+			/* Go directly after the previous group, wherever that turns out to be. */
+			group->follows_previous_group = cc_true;
+		}
+		else
+		{
+			/* Go directly after the previous segment. */
+			group->address = Buffer_Tell(&state->output_buffer);
+		}
+
+		state->output_ends_with_compressed_group = cc_true;
+		state->current_compressed_segment = NULL;
+
+		return QueueCompressedGroup(state, group);
+	}
+
+	return cc_true;
+}
+
+static void ChooseCandidate(CompressedGroup* const group)
+{
+	/* Keep the smallest data, since that is the most likely to fit. Ties go to the earliest format. */
+	CompressedGroup *best_candidate = NULL;
+	Buffer swap;
+	size_t i;
+
+	group->cached = cc_true;
+
+	for (i = 0; i < group->total_candidates; ++i)
+	{
+		CompressedGroup* const candidate = &group->candidates[i];
+
+		/* Failures are not ignored, since the same failure would likely happen with the one that gets chosen too. */
+		if (candidate->compressor_failed)
+			group->compressor_failed = cc_true;
+
+		if (candidate->compressed_data.out_of_memory)
+			group->compressed_data.out_of_memory = cc_true;
+
+		if (candidate->verification_failed)
+			group->verification_failed = cc_true;
+
+		if (candidate->verification_out_of_memory)
+			group->verification_out_of_memory = cc_true;
+
+		if (!candidate->cached)
+			group->cached = cc_false;
+
+		group->compression_time += candidate->compression_time;
+
+		if (best_candidate == NULL || candidate->compressed_data.size < best_candidate->compressed_data.size)
+			best_candidate = candidate;
+	}
+
+	if (best_candidate != NULL)
+	{
+		swap = group->compressed_data;
+		group->compressed_data = best_candidate->compressed_data;
+		best_candidate->compressed_data = swap;
+		group->compression = best_candidate->compression;
+	}
+}
+
+static const Extent* FindLaterOverlap(const State* const state, const CompressedGroup* const group, const unsigned long start_address, const unsigned long end_address)
+{
+	/* Segments that came after the group in the file used to overwrite its compressed data, so this is
+	   treated as an error rather than letting the compressed data silently win instead. */
+	size_t i;
+
+	for (i = group->first_later_extent; i < state->total_later_extents; ++i)
+		if (state->later_extents[i].start < end_address && state->later_extents[i].end > start_address)
+			return &state->later_extents[i];
+
+	return NULL;
+}
+
+static cc_bool LayOutCompressedGroups(State* const state)
+{
+	/* This runs at the same time as the verification jobs, so it must not touch the groups' verification flags. */
+	const double start_time = Timer_GetSeconds();
+	unsigned long end_address = 0;
+	size_t i;
+
+	for (i = 0; i < state->total_compressed_groups; ++i)
+	{
+		CompressedGroup* const group = state->compressed_groups[i];
+		const unsigned long compressed_size = group->compressed_data.size;
+		unsigned long start_address;
+		const Extent *overlap;
+		cc_bool too_large;
+
+		if (group->compressor_failed)
+		{
+			Error(state->options, "Failed to allocate memory for compressor.");
+			return cc_false;
+		}
+
+		if (group->compressed_data.out_of_memory)
+		{
+			OutOfMemory(state->options);
+			return cc_false;
+		}
+
+		start_address = group->follows_previous_group ? end_address : group->address;
+		end_address = start_address + compressed_size;
+
+		/* Check if we fit within the previous segment, and that no later segment overlaps the compressed data.
+		   A later segment that starts within the data means that not enough space was allocated for it. */
+		overlap = FindLaterOverlap(state, group, start_address, end_address);
+		too_large = (group->compressed_segment->type == P2BIN_TYPE_BEFORE && compressed_size > group->space_available)
+		         || (overlap != NULL && overlap->start >= start_address);
+		group->fits = !too_large && overlap == NULL;
+
+		/* When planning, every group is laid out regardless, so that the caller learns the size of all of them at once. */
+		if (!group->fits && !state->options->plan)
+		{
+			if (too_large)
+				NotEnoughSpace(state, group->compressed_segment, compressed_size);
+			else
+				ErrorWithConstant(state->options, "The compressed segments of '%s' are overwritten by a later segment at $%lX.", group->compressed_segment->constant, overlap->start);
+
+			return cc_false;
+		}
+
+		/* A cache hit is copied straight into the ROM, just like freshly-compressed data. */
+		Buffer_Seek(&state->output_buffer, start_address);
+		Buffer_Write(&state->output_buffer, group->compressed_data.data, compressed_size);
+
+		if (end_address > state->maximum_address)
+			state->maximum_address = end_address;
+
+		group->address = start_address;
+	}
+
+	state->statistics.layout_time = Timer_GetSeconds() - start_time;
+
+	return cc_true;
+}
+
+static cc_bool EmitCompressedGroups(State* const state)
+{
+	/* Wait for every group to be compressed, and then insert them into the ROM in order. */
+	const double start_time = Timer_GetSeconds();
+	size_t i, j;
+
+	FinishCompression(state);
+
+	/* Now that this conversion is not holding any entries, it is safe to wait for other conversions. */
+	for (i = 0; i < state->total_queued_groups; ++i)
+	{
+		CompressedGroup* const group = state->queued_groups[i];
+
+		if (group->shared_cache_entry != NULL && !group->owns_shared_cache_entry)
+		{
+			CollectSharedCacheEntry(group);
+
+			/* Compress any group whose shared entry could not be filled-in. */
+			CompressGroup(group);
+
+			/* Everything else was verified on the pipeline, straight after being compressed. When running in a
+			   batch, the other conversions are busy with the other processors, so this is done right here. */
+			if (state->options->verify)
+				VerifyGroup(group);
+		}
+	}
+
+	for (i = 0; i < state->total_compressed_groups; ++i)
+	{
+		CompressedGroup* const group = state->compressed_groups[i];
+
+		if (group->total_modules != 0)
+			JoinModules(group);
+
+		for (j = 0; j < group->total_candidates; ++j)
+			if (group->candidates[j].total_modules != 0)
+				JoinModules(&group->candidates[j]);
+
+		if (group->compression == P2BIN_COMPRESSION_AUTO)
+			ChooseCandidate(group);
+	}
+
+	state->statistics.compression_time = Timer_GetSeconds() - start_time;
+
+	for (i = 0; i < state->total_compressed_groups; ++i)
+	{
+		const CompressedGroup* const group = state->compressed_groups[i];
+
+		if (group->verification_out_of_memory)
+		{
+			OutOfMemory(state->options);
+			return cc_false;
+		}
+
+		if (group->verification_failed)
+		{
+			ErrorWithConstant(state->options, "Verification of the compressed data for '%s' failed.", group->compressed_segment->constant, 0);
+			return cc_false;
+		}
+	}
+
+	return LayOutCompressedGroups(state);
+}
+
+static void FreeCompressedGroup(CompressedGroup* const group)
+{
+	/* Frees what the group owns, but not the group itself. */
+	size_t i;
+
+	for (i = 0; i < group->total_candidates; ++i)
+		FreeCompressedGroup(&group->candidates[i]);
+
+	for (i = 0; i < group->total_modules; ++i)
+		FreeCompressedGroup(&group->modules[i]);
+
+	free(group->candidates);
+	free(group->modules);
+	Buffer_Free(&group->compressed_data);
+}
+
+static void FreeCompressedGroups(State* const state)
+{
+	size_t i;
+
+	for (i = 0; i < state->total_compressed_groups; ++i)
+	{
+		FreeCompressedGroup(state->compressed_groups[i]);
+		free(state->compressed_groups[i]);
+	}
+
+	free(state->compressed_groups);
+	free(state->queued_groups);
+}
+
+static int CompareCompressedSegments(const void* const a, const void* const b)
+{
+	const P2Bin_CompressedSegment* const segment_a = *(const P2Bin_CompressedSegment* const*)a;
+	const P2Bin_CompressedSegment* const segment_b = *(const P2Bin_CompressedSegment* const*)b;
+
+	/* Segments of different processor families can share an address, as each family has its own address space. */
+	if (segment_a->processor_family != segment_b->processor_family)
+		return segment_a->processor_family < segment_b->processor_family ? -1 : 1;
+
+	if (segment_a->starting_address != segment_b->starting_address)
+		return segment_a->starting_address < segment_b->starting_address ? -1 : 1;
+
+	/* Keep duplicates in their original order, so that they are reported in that order. */
+	return segment_a < segment_b ? -1 : segment_a > segment_b;
+}
+
+static cc_bool IndexCompressedSegments(State* const state)
+{
+	const size_t total_segments = state->options->total_compressed_segments;
+	size_t i;
+
+	if (total_segments == 0)
+		return cc_true;
+
+	state->compressed_segment_index = (const P2Bin_CompressedSegment**)malloc(sizeof(*state->compressed_segment_index) * total_segments);
+
+	if (state->compressed_segment_index == NULL)
+	{
+		OutOfMemory(state->options);
+		return cc_false;
+	}
+
+	for (i = 0; i < total_segments; ++i)
+		state->compressed_segment_index[i] = &state->options->compressed_segments[i];
+
+	qsort(state->compressed_segment_index, total_segments, sizeof(*state->compressed_segment_index), CompareCompressedSegments);
+
+	/* Only one of two descriptors for the same segments could be used, so the other would be silently ignored. */
+	for (i = 1; i < total_segments; ++i)
+	{
+		const P2Bin_CompressedSegment* const segment = state->compressed_segment_index[i];
+		const P2Bin_CompressedSegment* const previous_segment = state->compressed_segment_index[i - 1];
+
+		if (segment->processor_family == previous_segment->processor_family && segment->starting_address == previous_segment->starting_address)
+		{
+			ErrorWithConstant(state->options, "'%s' has the same processor family and starting address ($%lX) as another compressed segment.", segment->constant, segment->starting_address);
+			return cc_false;
+		}
+	}
+
+	state->total_indexed_compressed_segments = total_segments;
+
+	return cc_true;
+}
+
+static const P2Bin_CompressedSegment* FindCompressedSegment(const State* const state, const unsigned int processor_family, const unsigned long starting_address)
+{
+	/* Binary search, so that ROMs with many compressed regions do not slow to a crawl. */
+	size_t low = 0, high = state->total_indexed_compressed_segments;
+
+	while (low != high)
+	{
+		const size_t middle = low + (high - low) / 2;
+		const P2Bin_CompressedSegment* const segment = state->compressed_segment_index[middle];
+
+		if (segment->processor_family == processor_family && segment->starting_address == starting_address)
+			return segment;
+		else if (segment->processor_family < processor_family || (segment->processor_family == processor_family && segment->starting_address < starting_address))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return NULL;
+}
+
+static cc_bool AddLaterExtent(State* const state, const unsigned long start_address, const unsigned long end_address)
+{
+	/* AS usually emits long runs of segments that directly follow one another, so these are merged into one.
+	   An extent from before the newest group must be left alone, as that group only checks the extents after it. */
+	const size_t first_mergeable_extent = state->compressed_groups[state->total_compressed_groups - 1]->first_later_extent;
+
+	if (state->total_later_extents > first_mergeable_extent && state->later_extents[state->total_later_extents - 1].end == start_address)
+	{
+		state->later_extents[state->total_later_extents - 1].end = end_address;
+		return cc_true;
+	}
+
+	if (state->total_later_extents == state->later_extents_capacity)
+	{
+		const size_t new_capacity = state->later_extents_capacity == 0 ? 0x10 : state->later_extents_capacity * 2;
+		Extent* const new_extents = (Extent*)realloc(state->later_extents, sizeof(Extent) * new_capacity);
+
+		if (new_extents == NULL)
+		{
+			OutOfMemory(state->options);
+			return cc_false;
+		}
+
+		state->later_extents = new_extents;
+		state->later_extents_capacity = new_capacity;
+	}
+
+	state->later_extents[state->total_later_extents].start = start_address;
+	state->later_extents[state->total_later_extents].end = end_address;
+	++state->total_later_extents;
+
+	return cc_true;
+}
+
+static cc_bool ProcessSegment(State* const state, const unsigned int processor_family)
+{
+	const unsigned long start_address = ReadLongInt(state);
+	const unsigned int length = ReadWord(state);
+	const unsigned long end_address = start_address + length;
+	const P2Bin_CompressedSegment *matching_compressed_segment = NULL;
+	const cc_bool is_continued_compressed_segment = state->current_compressed_segment != NULL && processor_family == state->current_compressed_segment->processor_family && start_address == state->last_compressed_segment_end;
+
+	++state->statistics.segments_per_family[processor_family & 0xFF];
+	state->statistics.segment_bytes += length;
+
+	matching_compressed_segment = FindCompressedSegment(state, processor_family, start_address);
+
+	/* Sound driver Z80 code must be compressed, as can any other data that a descriptor asks for.
+	   The telltale sign of compressable Z80 code is that its first segment has an address of 0. */
+	if (matching_compressed_segment != NULL || is_continued_compressed_segment)
+	{
+		/* What we do is read as many consecutive segments as possible into the arena and then start
+		   compressing them when we encounter a segment of another kind or the end of the code file. */
+
+		/* If we encounter an eligible segment that doesn't continue directly
+		   after the last one, then begin a new compressed chunk. */
+		if (!is_continued_compressed_segment)
+		{
+			if (!FinishCompressedGroup(state))
+				return cc_false;
+
+			state->current_compressed_segment = matching_compressed_segment;
+			state->group_start = Buffer_Tell(&state->arena);
+		}
+
+		state->last_compressed_segment_end = end_address;
+
+		Buffer_Write(&state->arena, ReadBytes(state, length), length);
+	}
+	else
+	{
+		/* If a compressed segment is in-progress, then queue it, and make note of this segment so that it can be checked for overlap later. */
+		if (state->current_compressed_segment != NULL)
+		{
+			if (!FinishCompressedGroup(state))
+				return cc_false;
+
+			state->compressed_groups[state->total_compressed_groups - 1]->has_following_segment = cc_true;
+		}
+
+		if (state->total_compressed_groups != 0 && length != 0 && !AddLaterExtent(state, start_address, end_address))
+			return cc_false;
+
+		if (start_address > state->maximum_address)
+		{
+			/* Set padding bytes between segments. */
+			const unsigned long padding_length = start_address - state->maximum_address;
+
+			state->statistics.padding_bytes += padding_length;
+
+			Buffer_Seek(&state->output_buffer, state->maximum_address);
+			Buffer_Fill(&state->output_buffer, state->options->padding_value, padding_length);
+		}
+		else
+		{
+			Buffer_Seek(&state->output_buffer, start_address);
+		}
+
+		/* Copy segment data. */
+		Buffer_Write(&state->output_buffer, ReadBytes(state, length), length);
+
+		if (end_address > state->maximum_address)
+			state->maximum_address = end_address;
+
+		state->previous_68k_segment_start = start_address;
+		state->previous_68k_segment_length = length;
+		state->output_ends_with_compressed_group = cc_false;
+	}
+
+	return cc_true;
+}
+
+static cc_bool ApplyFixups(State* const state)
+{
+	/* Write the sizes and addresses of the compressed groups into the ROM, so that another tool does not have to do it with the header file. */
+	size_t i, j;
+
+	for (i = 0; i < state->options->total_fixups; ++i)
+	{
+		const P2Bin_Fixup* const fixup = &state->options->fixups[i];
+		const CompressedGroup *group = NULL;
+		unsigned long value = 0;
+		unsigned int byte;
+
+		for (j = state->total_compressed_groups; j-- != 0; )
+		{
+			if (strcmp(state->compressed_groups[j]->compressed_segment->constant, fixup->constant) == 0)
+			{
+				group = state->compressed_groups[j];
+				break;
+			}
+		}
+
+		if (group == NULL)
+		{
+			ErrorWithConstant(state->options, "There are no compressed segments for the fix-up of '%s'.", fixup->constant, 0);
+			return cc_false;
+		}
+
+		switch (fixup->value)
+		{
+			case P2BIN_FIXUP_SIZE:
+				value = group->compressed_data.size;
+				break;
+
+			case P2BIN_FIXUP_START:
+				value = group->address;
+				break;
+
+			case P2BIN_FIXUP_END:
+				value = group->address + group->compressed_data.size;
+				break;
+		}
+
+		if (fixup->size < 4 && value >> (fixup->size * 8) != 0)
+		{
+			ErrorWithConstant(state->options, "The fix-up of '%s' is too small for its value ($%lX).", fixup->constant, value);
+			return cc_false;
+		}
+
+		if (fixup->address > state->maximum_address || state->maximum_address - fixup->address < fixup->size)
+		{
+			ErrorWithConstant(state->options, "The fix-up of '%s' at $%lX is outside of the ROM.", fixup->constant, fixup->address);
+			return cc_false;
+		}
+
+		for (byte = 0; byte < fixup->size; ++byte)
+			state->output_buffer.data[fixup->address + byte] = (unsigned char)(value >> ((fixup->size - 1 - byte) * 8) & 0xFF);
+	}
+
+	return cc_true;
+}
+
+static cc_bool WriteMegaDriveHeader(State* const state)
+{
+	/* The ROM is already in memory, so this is much cheaper than having another tool read it back in afterwards. */
+	unsigned char* const rom = state->output_buffer.data;
+	const unsigned long rom_size = state->maximum_address;
+	const unsigned long end_address = rom_size - 1;
+	/* Only the bottom 16 bits matter, so this is allowed to wrap. */
+	unsigned long checksum = 0;
+	unsigned long i;
+
+	if (rom_size < 0x200)
+	{
+		Error(state->options, "The ROM is too small to have a Mega Drive header.");
+		return cc_false;
+	}
+
+	/* The checksum is the sum of every big-endian word after the header. This is kept simple, so that compilers can vectorise it. */
+	for (i = 0x200; i < (rom_size & ~1UL); i += 2)
+		checksum += (unsigned int)rom[i] << 8 | rom[i + 1];
+
+	/* A byte on its own at the end is treated as the top half of a word. */
+	if (rom_size % 2 != 0)
+		checksum += (unsigned int)rom[rom_size - 1] << 8;
+
+	rom[0x18E] = (unsigned char)(checksum >> 8 & 0xFF);
+	rom[0x18F] = (unsigned char)(checksum >> 0 & 0xFF);
+
+	rom[0x1A4] = (unsigned char)(end_address >> 24 & 0xFF);
+	rom[0x1A5] = (unsigned char)(end_address >> 16 & 0xFF);
+	rom[0x1A6] = (unsigned char)(end_address >> 8 & 0xFF);
+	rom[0x1A7] = (unsigned char)(end_address >> 0 & 0xFF);
+
+	return cc_true;
+}
+
+static void PrematureEnd(const State* const state)
+{
+	Error(state->options, "File ended prematurely.");
+}
+
+static cc_bool ProcessRecords(State* const state)
+{
+	/* Read and check the header's magic number. */
+	if (!InputAvailable(state, 2))
+	{
+		Error(state->options, "Could not read header magic value.");
+		return cc_false;
+	}
+	else if (state->input_pointer[0] != 0x89 || state->input_pointer[1] != 0x14)
+	{
+		char message[0x80];
+		sprintf(message, "Invalid header magic value - expected 0x8914 but got 0x%02X%02X.\nInput file is either corrupt or not a valid AS code file.", state->input_pointer[0], state->input_pointer[1]);
+		Error(state->options, message);
+		return cc_false;
+	}
+
+	/* Skip the magic number. */
+	ReadWord(state);
+
+	for (;;)
+	{
+		unsigned int record_header;
+		unsigned int processor_family, granularity;
+
+		if (!InputAvailable(state, 1))
+		{
+			PrematureEnd(state);
+			return cc_false;
+		}
+
+		record_header = ReadByte(state);
+
+		switch (record_header)
+		{
+			case 0:
+				/* Creator string. This marks the end of the file. */
+
+				/* Queue the compressed segments here too, just in case it's the last segment in the file. */
+				if (!FinishCompressedGroup(state))
+					return cc_false;
+
+				/* Now that every group is known, compress them all and insert them into the ROM. */
+				if (!EmitCompressedGroups(state))
+					return cc_false;
+
+				if (state->output_buffer.out_of_memory)
+				{
+					OutOfMemory(state->options);
+					return cc_false;
+				}
+
+				return cc_true;
+
+			case 0x80:
+				/* Entry point. We don't care about this. */
+				if (!InputAvailable(state, 4))
+				{
+					PrematureEnd(state);
+					return cc_false;
+				}
+
+				ReadLongInt(state);
+				break;
+
+			case 0x81:
+				/* Arbitrary segment. */
+				if (!InputAvailable(state, 3))
+				{
+					PrematureEnd(state);
+					return cc_false;
+				}
+
+				processor_family = ReadByte(state);
+				ReadByte(state); /* Segment. We don't care about this. */
+				granularity = ReadByte(state);
+
+				if (granularity != 1)
+				{
+					char message[0x40];
+					sprintf(message, "Unsupported granularity of %u (only 1 is supported).", granularity);
+					Error(state->options, message);
+					return cc_false;
+				}
+
+				if (!SegmentAvailable(state))
+				{
+					PrematureEnd(state);
+					return cc_false;
+				}
+
+				if (!ProcessSegment(state, processor_family))
+					return cc_false;
+
+				break;
+
+			default:
+				if (record_header >= 0x80)
+				{
+					char message[0x40];
+					sprintf(message, "Unrecognised record header value (0x%02X).", record_header);
+					Error(state->options, message);
+					return cc_false;
+				}
+
+				/* Legacy CODE segment. */
+				if (!SegmentAvailable(state))
+				{
+					PrematureEnd(state);
+					return cc_false;
+				}
+
+				if (!ProcessSegment(state, record_header))
+					return cc_false;
+
+				break;
+		}
+	}
+}
+
+const char* const P2Bin_compression_names[P2BIN_COMPRESSION_AUTO + 1] = {
+	"uncompressed",
+	"kosinski",
+	"kosinski-optimised",
+	"saxman",
+	"saxman-bugged",
+	"saxman-optimised",
+	"kosinskiplus",
+	"kosinski-moduled",
+	"kosinski-moduled-optimised",
+	"auto"
+};
+
+int P2Bin_Convert(const unsigned char* const code_file, const size_t code_file_size, const P2Bin_Options* const options, P2Bin_Result* const result)
+{
+	const double start_time = Timer_GetSeconds();
+	cc_bool success = cc_false;
+	/* This is too large to put on the stack. */
+	State* const state = (State*)malloc(sizeof(State));
+
+	if (state == NULL)
+	{
+		OutOfMemory(options);
+	}
+	else
+	{
+		memset(state, 0, sizeof(*state));
+		state->options = options;
+		state->input_pointer = code_file;
+		state->input_end = code_file + code_file_size;
+		state->last_compressed_segment_end = -1;
+		state->statistics.bytes_read = code_file_size;
+
+		/* The arena can never need to be larger than the file, as the file contains all of its data. */
+		if (options->total_compressed_segments != 0 && !Buffer_Reserve(&state->arena, code_file_size))
+			OutOfMemory(options);
+		/* The header's checksum covers the fix-ups, so it is done last. */
+		else if (IndexCompressedSegments(state) && ProcessRecords(state) && ApplyFixups(state) && (!options->mega_drive_header || WriteMegaDriveHeader(state)))
+		{
+			result->total_compressed_groups = state->total_compressed_groups;
+			result->compressed_groups = (P2Bin_CompressedGroup*)malloc(sizeof(P2Bin_CompressedGroup) * state->total_compressed_groups + 1);
+
+			if (result->compressed_groups == NULL)
+			{
+				OutOfMemory(options);
+			}
+			else
+			{
+				size_t i;
+
+				for (i = 0; i < state->total_compressed_groups; ++i)
+				{
+					const CompressedGroup* const group = state->compressed_groups[i];
+					P2Bin_CompressedGroup* const result_group = &result->compressed_groups[i];
+
+					result_group->constant = group->compressed_segment->constant;
+					result_group->compression = group->compression;
+					result_group->automatic = group->compressed_segment->compression == P2BIN_COMPRESSION_AUTO;
+					result_group->address = group->address;
+					result_group->size = group->compressed_data.size;
+					result_group->uncompressed_size = group->uncompressed_size;
+					result_group->compression_time = group->compression_time;
+					result_group->cached = group->cached;
+					result_group->has_following_segment = group->has_following_segment;
+					result_group->fits = group->fits;
+				}
+
+				/* Whatever time was not spent on compression or layout was spent parsing. */
+				result->statistics = state->statistics;
+				result->statistics.parse_time = Timer_GetSeconds() - start_time - state->statistics.compression_time - state->statistics.layout_time;
+
+				/* Hand the ROM over to the caller. */
+				result->rom = state->output_buffer.data;
+				result->rom_size = state->maximum_address;
+				state->output_buffer.data = NULL;
+
+				success = cc_true;
+			}
+		}
+
+		/* If the conversion failed part-way through, then there may still be groups being compressed. */
+		FinishCompression(state);
+		FreeCompressedGroups(state);
+		free(state->compressed_segment_index);
+		free(state->later_extents);
+		Buffer_Free(&state->arena);
+		Buffer_Free(&state->output_buffer);
+		free(state);
+	}
+
+	return success;
+}
+
+void P2Bin_FreeResult(P2Bin_Result* const result)
+{
+	free(result->rom);
+	free(result->compressed_groups);
+}
+
+P2Bin_Cache* P2Bin_CreateCache(void)
+{
+	P2Bin_Cache* const cache = (P2Bin_Cache*)malloc(sizeof(P2Bin_Cache));
+
+	if (cache != NULL)
+	{
+		cache->mutex = Thread_CreateMutex();
+		cache->entry_list_head = NULL;
+
+		if (cache->mutex == NULL)
+		{
+			free(cache);
+			return NULL;
+		}
+	}
+
+	return cache;
+}
+
+void P2Bin_DestroyCache(P2Bin_Cache* const cache)
+{
+	CacheEntry *entry = cache->entry_list_head;
+
+	while (entry != NULL)
+	{
+		CacheEntry* const next_entry = entry->next;
+
+		DestroySharedCacheEntry(entry);
+
+		entry = next_entry;
+	}
+
+	Thread_DestroyMutex(cache->mutex);
+	free(cache);
+}
+
+void P2Bin_TrimCache(P2Bin_Cache* const cache)
+{
+	CacheEntry **link = &cache->entry_list_head;
+
+	while (*link != NULL)
+	{
+		CacheEntry* const entry = *link;
+
+		if (entry->used)
+		{
+			entry->used = cc_false;
+			link = &entry->next;
+		}
+		else
+		{
+			*link = entry->next;
+			DestroySharedCacheEntry(entry);
+		}
+	}
+}
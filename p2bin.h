@@ -0,0 +1,217 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* The core of p2bin, as a library: this converts a Macro Assembler AS code
+   file that is already in memory to a ROM image, also in memory. It does not
+   use any global state, and it reports errors through a callback rather than
+   by printing them, so it can be embedded in other programs. */
+
+#ifndef P2BIN_H
+#define P2BIN_H
+
+#include <stddef.h>
+
+typedef enum P2Bin_Compression
+{
+	P2BIN_COMPRESSION_UNCOMPRESSED,
+	P2BIN_COMPRESSION_KOSINSKI,
+	P2BIN_COMPRESSION_KOSINSKI_OPTIMISED,
+	P2BIN_COMPRESSION_SAXMAN,
+	P2BIN_COMPRESSION_SAXMAN_BUGGED,
+	P2BIN_COMPRESSION_SAXMAN_OPTIMISED,
+	P2BIN_COMPRESSION_KOSINSKIPLUS,
+	/* Kosinski in separately-compressed modules of 0x1000 bytes, after a
+	   big-endian word of the uncompressed size, which must be below 0x10000. */
+	P2BIN_COMPRESSION_KOSINSKI_MODULED,
+	P2BIN_COMPRESSION_KOSINSKI_MODULED_OPTIMISED,
+	/* Compress with every format in 'candidate_compressions' at once, and keep the smallest. */
+	P2BIN_COMPRESSION_AUTO
+} P2Bin_Compression;
+
+/* The name of each format, as used on the command line, indexed by 'P2Bin_Compression'. */
+extern const char* const P2Bin_compression_names[P2BIN_COMPRESSION_AUTO + 1];
+
+/* For building 'candidate_compressions'. */
+#define P2BIN_COMPRESSION_FLAG(compression) (1u << (compression))
+
+/* The candidates that are used if 'candidate_compressions' is 0. */
+#define P2BIN_COMPRESSION_DEFAULT_CANDIDATES (P2BIN_COMPRESSION_FLAG(P2BIN_COMPRESSION_KOSINSKI_OPTIMISED) | P2BIN_COMPRESSION_FLAG(P2BIN_COMPRESSION_SAXMAN_OPTIMISED) | P2BIN_COMPRESSION_FLAG(P2BIN_COMPRESSION_KOSINSKIPLUS))
+
+typedef enum P2Bin_Type
+{
+	P2BIN_TYPE_BEFORE, /* S&K */
+	P2BIN_TYPE_AFTER   /* S1, S2 */
+} P2Bin_Type;
+
+/* AS processor family codes for the segments that are most likely to be compressed. */
+#define P2BIN_PROCESSOR_FAMILY_68000 0x01
+#define P2BIN_PROCESSOR_FAMILY_Z80 0x51
+
+/* Describes a series of consecutive segments that should be compressed. */
+typedef struct P2Bin_CompressedSegment
+{
+	/* Only segments belonging to this processor family are compressed. This is usually 'P2BIN_PROCESSOR_FAMILY_Z80'. */
+	unsigned int processor_family;
+	unsigned long starting_address;
+	P2Bin_Compression compression;
+	/* Only used with 'P2BIN_COMPRESSION_AUTO'. */
+	unsigned int candidate_compressions;
+	/* If non-zero, then the Kosinski, Kosinski Moduled, and Saxman formats are
+	   compressed with a fast greedy compressor instead, which produces larger
+	   data that is still valid, and which can run on any number of threads at
+	   once. This is for development builds. Kosinski+ has no such compressor. */
+	int fast;
+	const char *constant;
+	P2Bin_Type type;
+} P2Bin_CompressedSegment;
+
+typedef enum P2Bin_FixupValue
+{
+	P2BIN_FIXUP_SIZE,  /* The size of the compressed data. */
+	P2BIN_FIXUP_START, /* The address of the compressed data. */
+	P2BIN_FIXUP_END    /* The address directly after the compressed data. */
+} P2Bin_FixupValue;
+
+/* Describes a place in the ROM where a value of a compressed group is written
+   once the group has been inserted, so that the ROM does not have to be
+   patched afterwards with the header file. */
+typedef struct P2Bin_Fixup
+{
+	unsigned long address;
+	/* The number of bytes to write, in big-endian: 1, 2, or 4. */
+	unsigned int size;
+	/* The constant of the compressed segment. If several groups have it, then the last one is used. */
+	const char *constant;
+	P2Bin_FixupValue value;
+} P2Bin_Fixup;
+
+/* An in-memory cache of compressed data, which can be shared between
+   conversions, even ones that are running at the same time on different
+   threads, so that identical data is only compressed once. */
+typedef struct P2Bin_Cache P2Bin_Cache;
+
+typedef struct P2Bin_Options
+{
+	const P2Bin_CompressedSegment *compressed_segments;
+	size_t total_compressed_segments;
+
+	const P2Bin_Fixup *fixups;
+	size_t total_fixups;
+
+	/* Byte to fill the gaps between segments with. */
+	unsigned int padding_value;
+
+	/* If not NULL, then compressed data is cached in this directory. */
+	const char *cache_directory;
+
+	/* If not NULL, then compressed data is shared through this cache. */
+	P2Bin_Cache *cache;
+
+	/* If non-zero, then the ROM end address and checksum in the Mega Drive ROM
+	   header are filled in, so that a separate tool does not have to do it. */
+	int mega_drive_header;
+
+	/* If non-zero, then compressed data is checked for correctness, by
+	   decompressing it again. There is no Kosinski+ decompressor, so Kosinski+
+	   is an error, and is left out of the candidates of 'auto'. */
+	int verify;
+
+	/* The most threads to compress with at once, or 0 for one per processor.
+	   This avoids starting too many threads when several conversions run at
+	   once, each with threads of their own. */
+	unsigned int total_threads;
+
+	/* If non-zero, then compressed data that does not fit in the space reserved
+	   for it is not an error, so that the space needed by every group can be
+	   found in a single run. The ROM is still produced, but it is not usable
+	   if any group did not fit. */
+	int plan;
+
+	/* Called with a description of each error that occurs. May be NULL. */
+	void (*error_callback)(void *user_data, const char *message);
+	void *error_callback_user_data;
+} P2Bin_Options;
+
+/* Describes a compressed series of segments that was inserted into the ROM. */
+typedef struct P2Bin_CompressedGroup
+{
+	const char *constant;
+	/* The format that was used. With 'P2BIN_COMPRESSION_AUTO', this is the one that was chosen. */
+	P2Bin_Compression compression;
+	/* Whether the format was chosen automatically. */
+	int automatic;
+	unsigned long address;
+	unsigned long size;
+	unsigned long uncompressed_size;
+	/* Wall-clock time spent compressing this group, in seconds. This is 0 if the
+	   data came from a cache. With 'P2BIN_COMPRESSION_AUTO', this is the total of
+	   every candidate. */
+	double compression_time;
+	/* Whether the compressed data came from a cache instead of being compressed. */
+	int cached;
+	/* Whether the group was followed by a non-compressed segment. The size of
+	   the last of these is written to the start of the header file, for
+	   compatibility. */
+	int has_following_segment;
+	/* Whether the compressed data fitted in the space reserved for it. This is
+	   only ever zero with 'plan'. */
+	int fits;
+} P2Bin_CompressedGroup;
+
+/* Counters and timings for a conversion, for finding out where the time goes. */
+typedef struct P2Bin_Statistics
+{
+	/* Wall-clock time spent in each phase, in seconds. Groups are compressed in
+	   the background while the file is parsed, so 'compression_time' is only
+	   the time spent waiting for them to finish afterwards, and is usually much
+	   less than the sum of the groups' individual times. */
+	double parse_time;
+	double compression_time;
+	double layout_time;
+
+	unsigned long bytes_read;
+	unsigned long segment_bytes;
+	unsigned long padding_bytes;
+
+	/* Indexed by AS processor family code. */
+	unsigned long segments_per_family[0x100];
+} P2Bin_Statistics;
+
+typedef struct P2Bin_Result
+{
+	unsigned char *rom;
+	size_t rom_size;
+
+	P2Bin_CompressedGroup *compressed_groups;
+	size_t total_compressed_groups;
+
+	P2Bin_Statistics statistics;
+} P2Bin_Result;
+
+/* Returns non-zero on success. On success, 'result' must be freed with
+   'P2Bin_FreeResult'. On failure, there is nothing to free. */
+int P2Bin_Convert(const unsigned char *code_file, size_t code_file_size, const P2Bin_Options *options, P2Bin_Result *result);
+void P2Bin_FreeResult(P2Bin_Result *result);
+
+/* Returns NULL on failure. */
+P2Bin_Cache* P2Bin_CreateCache(void);
+void P2Bin_DestroyCache(P2Bin_Cache *cache);
+
+/* Frees every entry that has not been used by a conversion since the last
+   call, so that a long-lived cache does not fill up with stale data. This
+   must not be called while a conversion that uses the cache is running. */
+void P2Bin_TrimCache(P2Bin_Cache *cache);
+
+#endif /* P2BIN_H */
@@ -0,0 +1,423 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* Regression tests for bugs that would otherwise go unnoticed, because they
+   only show up as slightly different output. Run them with 'ctest'. */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz_comp2/LZSS.h"
+
+#include "greedy.h"
+#include "p2bin.h"
+
+typedef struct Bytes
+{
+	unsigned char data[0x100];
+	size_t size, position;
+} Bytes;
+
+static unsigned int total_failures;
+
+static void Check(const int condition, const char* const test, const char* const description)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "FAIL: %s: %s\n", test, description);
+		++total_failures;
+	}
+}
+
+static int Bytes_Read(void* const user_data)
+{
+	Bytes* const bytes = (Bytes*)user_data;
+
+	return bytes->position == bytes->size ? EOF : bytes->data[bytes->position++];
+}
+
+static void Bytes_Write(void* const user_data, const int byte)
+{
+	Bytes* const bytes = (Bytes*)user_data;
+
+	if (bytes->size != sizeof(bytes->data))
+		bytes->data[bytes->size++] = (unsigned char)byte;
+}
+
+static void Bytes_WriteBlock(void* const user_data, const unsigned char* const data, const size_t total_bytes)
+{
+	size_t i;
+
+	for (i = 0; i < total_bytes; ++i)
+		Bytes_Write(user_data, data[i]);
+}
+
+static void TestShortSaxman(void)
+{
+	/* Inputs that are shorter than the longest match are compared against parts of the ring buffer that the
+	   encoder does not write to, so those parts must not be left holding whatever was in memory before. */
+	static const char test[] = "short Saxman input";
+	static const unsigned char input[] = {1, 2, 3, 1, 2, 3, 1, 2, 3, 0, 0, 0};
+	/* This is too large to put on the stack. */
+	LZSS_State* const state = (LZSS_State*)malloc(sizeof(LZSS_State));
+	Bytes first, second, decoded;
+
+	if (state == NULL)
+	{
+		Check(0, test, "out of memory");
+		return;
+	}
+
+	/* Fill the state with different garbage each time, like reused heap memory. */
+	memset(state, 0x00, sizeof(*state));
+	first.size = 0;
+	LZSS_Encode(state, input, sizeof(input), Bytes_WriteBlock, &first);
+
+	memset(state, 0xFF, sizeof(*state));
+	second.size = 0;
+	LZSS_Encode(state, input, sizeof(input), Bytes_WriteBlock, &second);
+
+	Check(first.size == second.size && memcmp(first.data, second.data, first.size) == 0, test, "compressing twice gave different results");
+
+	memset(state, 0xAA, sizeof(*state));
+	first.position = 0;
+	decoded.size = 0;
+	LZSS_Decode(state, Bytes_Read, &first, Bytes_Write, &decoded);
+
+	Check(decoded.size == sizeof(input) && memcmp(decoded.data, input, sizeof(input)) == 0, test, "decompressing gave different data");
+
+	free(state);
+}
+
+static void TestGreedySaxman(void)
+{
+	/* The greedy compressor is not checked against another compressor, so check that the authentic decompressor understands it. */
+	static const char test[] = "greedy Saxman";
+	/* This is too large to put on the stack. */
+	LZSS_State* const state = (LZSS_State*)malloc(sizeof(LZSS_State));
+	Bytes source, compressed, decoded;
+	size_t i;
+
+	if (state == NULL)
+	{
+		Check(0, test, "out of memory");
+		return;
+	}
+
+	/* Runs, repeats, and overlapping matches, with enough data for more than one flag byte. */
+	for (i = 0; i < 0xF0; ++i)
+		source.data[i] = i < 0x20 ? (unsigned char)i : i < 0x60 ? source.data[i % 0x13] : i < 0x90 ? 0x55 : (unsigned char)(i * 7 ^ i >> 3);
+
+	source.size = 0xF0;
+	compressed.size = 0;
+	Check(Greedy_SaxmanCompress(source.data, source.size, Bytes_WriteBlock, &compressed), test, "compressor failed");
+	Check(compressed.size < source.size, test, "data did not get smaller");
+
+	compressed.position = 0;
+	decoded.size = 0;
+	LZSS_Decode(state, Bytes_Read, &compressed, Bytes_Write, &decoded);
+
+	Check(decoded.size == source.size && memcmp(decoded.data, source.data, source.size) == 0, test, "decompressing gave different data");
+
+	free(state);
+}
+
+static size_t DecompressKosinski(const unsigned char* const data, const size_t size, unsigned char* const output, const size_t output_capacity, size_t* const output_size)
+{
+	/* Written separately from p2bin's own decompressor, so that the two do not share bugs.
+	   Returns how many bytes of 'data' were used, or 0 if the data is malformed. */
+	size_t position = 0, written = 0;
+	unsigned int descriptor = 0, bits_remaining = 0;
+
+#define READ_BYTE(byte) do { if (position == size) return 0; (byte) = data[position++]; } while (0)
+#define READ_DESCRIPTOR() do { if (size - position < 2) return 0; descriptor = data[position] | (unsigned int)data[position + 1] << 8; bits_remaining = 16; position += 2; } while (0)
+	/* The next descriptor is read as soon as the last bit of this one is used, before the rest of the match. */
+#define READ_BIT(bit) do { (bit) = descriptor & 1; descriptor >>= 1; if (--bits_remaining == 0) READ_DESCRIPTOR(); } while (0)
+
+	READ_DESCRIPTOR();
+
+	for (;;)
+	{
+		unsigned int bit, low_bit, byte, high_byte, distance, count;
+
+		READ_BIT(bit);
+
+		if (bit != 0)
+		{
+			READ_BYTE(byte);
+
+			if (written == output_capacity)
+				return 0;
+
+			output[written++] = (unsigned char)byte;
+			continue;
+		}
+
+		READ_BIT(bit);
+
+		if (bit == 0)
+		{
+			READ_BIT(bit);
+			READ_BIT(low_bit);
+			READ_BYTE(byte);
+			count = (bit << 1 | low_bit) + 2;
+			distance = 0x100 - byte;
+		}
+		else
+		{
+			READ_BYTE(byte);
+			READ_BYTE(high_byte);
+			distance = 0x2000 - ((high_byte & 0xF8) << 5 | byte);
+			count = (high_byte & 7) + 2;
+
+			if (count == 2)
+			{
+				READ_BYTE(count);
+
+				if (count == 0)
+					break;
+				else if (count == 1)
+					continue;
+
+				++count;
+			}
+		}
+
+		if (distance > written || output_capacity - written < count)
+			return 0;
+
+		for (; count != 0; --count, ++written)
+			output[written] = output[written - distance];
+	}
+
+#undef READ_BIT
+#undef READ_DESCRIPTOR
+#undef READ_BYTE
+
+	*output_size = written;
+	return position;
+}
+
+static void ErrorCallback(void* const user_data, const char* const message)
+{
+	fprintf(stderr, "%s: %s\n", (const char*)user_data, message);
+}
+
+static void RecordError(void* const user_data, const char* const message)
+{
+	/* Errors that a test expects are kept for it to check, instead of being printed. */
+	char* const buffer = (char*)user_data;
+
+	strncpy(buffer, message, 0xFF);
+	buffer[0xFF] = '\0';
+}
+
+static unsigned char* AppendSegment(unsigned char* const pointer, const unsigned int processor_family, const unsigned long start_address, const unsigned int fill, const unsigned int length)
+{
+	/* Writes a segment record in the format that AS uses, filled with a single byte. */
+	unsigned char *output = pointer;
+	unsigned int i;
+
+	*output++ = 0x81;
+	*output++ = processor_family;
+	*output++ = 0; /* Segment. */
+	*output++ = 1; /* Granularity. */
+
+	for (i = 0; i < 4; ++i)
+		*output++ = (start_address >> (8 * i)) & 0xFF;
+
+	*output++ = (length >> (8 * 0)) & 0xFF;
+	*output++ = (length >> (8 * 1)) & 0xFF;
+
+	memset(output, fill, length);
+
+	return output + length;
+}
+
+static void TestLaterOverlapAfterSecondGroup(void)
+{
+	/* A segment that directly follows one that came after the first group, but which
+	   lands on the second group, must not be merged into what only the first group checks. */
+	static const char test[] = "later segment overlapping the second group";
+	P2Bin_CompressedSegment compressed_segments[2];
+	P2Bin_Options options;
+	P2Bin_Result result;
+	unsigned char code_file[0x400];
+	unsigned char *pointer = code_file;
+	char message[0x100];
+
+	*pointer++ = 0x89;
+	*pointer++ = 0x14;
+	pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_68000, 0x0000, 0x11, 0x100);
+	pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_Z80, 0x0000, 0x22, 0x100);   /* G1, at $100-$200. */
+	pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_68000, 0x0200, 0x33, 0x10);
+	pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_Z80, 0x1000, 0x44, 0x100);   /* G2, at $210-$310. */
+	pointer = AppendSegment(pointer, P2BIN_PROCESSOR_FAMILY_68000, 0x0210, 0x55, 0x10); /* Where G2 goes. */
+	*pointer++ = 0x00;
+
+	memset(compressed_segments, 0, sizeof(compressed_segments));
+	compressed_segments[0].processor_family = P2BIN_PROCESSOR_FAMILY_Z80;
+	compressed_segments[0].starting_address = 0x0000;
+	compressed_segments[0].compression = P2BIN_COMPRESSION_UNCOMPRESSED;
+	compressed_segments[0].constant = "G1";
+	compressed_segments[0].type = P2BIN_TYPE_AFTER;
+	compressed_segments[1] = compressed_segments[0];
+	compressed_segments[1].starting_address = 0x1000;
+	compressed_segments[1].constant = "G2";
+
+	memset(&options, 0, sizeof(options));
+	options.compressed_segments = compressed_segments;
+	options.total_compressed_segments = 2;
+	options.error_callback = RecordError;
+	options.error_callback_user_data = message;
+
+	message[0] = '\0';
+
+	if (P2Bin_Convert(code_file, pointer - code_file, &options, &result))
+	{
+		Check(0, test, "the overlap was not reported");
+		P2Bin_FreeResult(&result);
+	}
+	else
+	{
+		Check(strstr(message, "'G2'") != NULL, test, "the overlap was reported for the wrong group");
+	}
+}
+
+static void TestKosinskiModuled(const P2Bin_Compression compression, const int fast, const char* const test)
+{
+	/* Three modules, so that there is padding between them, with the last one shorter than the rest. */
+	enum {UNCOMPRESSED_SIZE = 0x2345};
+	P2Bin_CompressedSegment compressed_segment;
+	P2Bin_Options options;
+	P2Bin_Result result;
+	unsigned char *code_file, *uncompressed, *decompressed;
+	unsigned long seed = 1;
+	size_t i;
+
+	code_file = (unsigned char*)malloc(2 + 10 + 4 + 10 + UNCOMPRESSED_SIZE + 10 + 4 + 1);
+	uncompressed = &code_file[2 + 10 + 4 + 10];
+	decompressed = (unsigned char*)malloc(UNCOMPRESSED_SIZE);
+
+	if (code_file == NULL || decompressed == NULL)
+	{
+		Check(0, test, "out of memory");
+		free(code_file);
+		free(decompressed);
+		return;
+	}
+
+	/* A 68000 segment, then the data as a Z80 segment at address 0 to be compressed after it, then a 68000 segment at the end of the space for it. */
+	memcpy(code_file, "\x89\x14" "\x81\x01\x00\x01" "\x00\x00\x00\x00" "\x04\x00" "\x00\x00\x00\x00", 2 + 10 + 4);
+	memcpy(&code_file[2 + 10 + 4], "\x81\x51\x00\x01" "\x00\x00\x00\x00" "\x45\x23", 10);
+	memcpy(&code_file[2 + 10 + 4 + 10 + UNCOMPRESSED_SIZE], "\x81\x01\x00\x01" "\x00\x80\x00\x00" "\x04\x00" "\x00\x00\x00\x00" "\x00", 10 + 4 + 1);
+
+	/* A mix of noise and repeats, some of which reach back further than one module. */
+	for (i = 0; i < UNCOMPRESSED_SIZE; ++i)
+	{
+		seed = (seed * 1103515245 + 12345) & 0xFFFFFFFF;
+
+		if (i >= 0x1100 && (seed >> 16) % 4 == 0)
+			uncompressed[i] = uncompressed[i - 0x1100];
+		else if (i >= 8 && (seed >> 16) % 4 == 1)
+			uncompressed[i] = uncompressed[i - 8];
+		else
+			uncompressed[i] = (unsigned char)(seed >> 24);
+	}
+
+	memset(&compressed_segment, 0, sizeof(compressed_segment));
+	compressed_segment.processor_family = P2BIN_PROCESSOR_FAMILY_Z80;
+	compressed_segment.starting_address = 0;
+	compressed_segment.compression = compression;
+	compressed_segment.fast = fast;
+	compressed_segment.constant = "Test";
+	compressed_segment.type = P2BIN_TYPE_AFTER;
+
+	memset(&options, 0, sizeof(options));
+	options.compressed_segments = &compressed_segment;
+	options.total_compressed_segments = 1;
+	options.verify = 1;
+	options.error_callback = ErrorCallback;
+	options.error_callback_user_data = (void*)test;
+
+	if (!P2Bin_Convert(code_file, 2 + 10 + 4 + 10 + UNCOMPRESSED_SIZE + 10 + 4 + 1, &options, &result))
+	{
+		Check(0, test, "conversion failed");
+	}
+	else
+	{
+		const unsigned char* const compressed = &result.rom[result.compressed_groups[0].address];
+		const size_t compressed_size = result.compressed_groups[0].size;
+		size_t position = 2, total_decompressed = 0, total_modules = 0;
+
+		Check(compressed_size >= 2 && compressed[0] == 0x23 && compressed[1] == 0x45, test, "the header is not the big-endian uncompressed size");
+
+		while (position < compressed_size && total_decompressed < UNCOMPRESSED_SIZE)
+		{
+			size_t module_size;
+			const size_t used = DecompressKosinski(&compressed[position], compressed_size - position, &decompressed[total_decompressed], UNCOMPRESSED_SIZE - total_decompressed, &module_size);
+
+			if (used == 0)
+			{
+				Check(0, test, "a module is malformed");
+				break;
+			}
+
+			++total_modules;
+			total_decompressed += module_size;
+			position += used;
+
+			Check(module_size == (total_decompressed == UNCOMPRESSED_SIZE ? UNCOMPRESSED_SIZE % 0x1000 : 0x1000), test, "a module is the wrong size");
+
+			/* Every module but the last is padded to 0x10 bytes, counting from the end of the header. */
+			if (total_decompressed != UNCOMPRESSED_SIZE)
+			{
+				for (; (position - 2) % 0x10 != 0 && position < compressed_size; ++position)
+					Check(compressed[position] == 0, test, "the padding after a module is not zero");
+
+				Check((position - 2) % 0x10 == 0, test, "the data ends in the padding after a module");
+			}
+		}
+
+		Check(total_modules == 3, test, "the data is not split into three modules");
+		Check(total_decompressed == UNCOMPRESSED_SIZE && memcmp(decompressed, uncompressed, UNCOMPRESSED_SIZE) == 0, test, "decompressing gave different data");
+
+		P2Bin_FreeResult(&result);
+	}
+
+	free(code_file);
+	free(decompressed);
+}
+
+int main(void)
+{
+	TestShortSaxman();
+	TestGreedySaxman();
+	TestLaterOverlapAfterSecondGroup();
+	TestKosinskiModuled(P2BIN_COMPRESSION_KOSINSKI_MODULED, 0, "Kosinski Moduled");
+	TestKosinskiModuled(P2BIN_COMPRESSION_KOSINSKI_MODULED_OPTIMISED, 0, "Kosinski Moduled (optimised)");
+	TestKosinskiModuled(P2BIN_COMPRESSION_KOSINSKI_MODULED_OPTIMISED, 1, "Kosinski Moduled (fast)");
+
+	if (total_failures != 0)
+	{
+		fprintf(stderr, "%u test(s) failed.\n", total_failures);
+		return EXIT_FAILURE;
+	}
+
+	fputs("All tests passed.\n", stderr);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,549 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "thread.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#if defined(_WIN32) || defined(P2BIN_PTHREADS)
+
+#if defined(_WIN32)
+
+#include <windows.h>
+
+typedef HANDLE Thread;
+typedef SRWLOCK Mutex;
+
+#define MUTEX_INITIALISER SRWLOCK_INIT
+#define InitialiseMutex(mutex) (InitializeSRWLock(mutex), 1)
+#define DeinitialiseMutex(mutex) ((void)(mutex))
+#define LockMutex(mutex) AcquireSRWLockExclusive(mutex)
+#define UnlockMutex(mutex) ReleaseSRWLockExclusive(mutex)
+
+typedef CONDITION_VARIABLE Condition;
+
+#define InitialiseCondition(condition) (InitializeConditionVariable(condition), 1)
+#define DeinitialiseCondition(condition) ((void)(condition))
+#define WaitCondition(condition, mutex) SleepConditionVariableSRW(condition, mutex, INFINITE, 0)
+#define SignalCondition(condition) WakeConditionVariable(condition)
+#define BroadcastCondition(condition) WakeAllConditionVariable(condition)
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+
+#define MUTEX_INITIALISER PTHREAD_MUTEX_INITIALIZER
+#define InitialiseMutex(mutex) (pthread_mutex_init(mutex, NULL) == 0)
+#define DeinitialiseMutex(mutex) pthread_mutex_destroy(mutex)
+#define LockMutex(mutex) pthread_mutex_lock(mutex)
+#define UnlockMutex(mutex) pthread_mutex_unlock(mutex)
+
+typedef pthread_cond_t Condition;
+
+#define InitialiseCondition(condition) (pthread_cond_init(condition, NULL) == 0)
+#define DeinitialiseCondition(condition) pthread_cond_destroy(condition)
+#define WaitCondition(condition, mutex) pthread_cond_wait(condition, mutex)
+#define SignalCondition(condition) pthread_cond_signal(condition)
+#define BroadcastCondition(condition) pthread_cond_broadcast(condition)
+
+#endif
+
+struct Thread_Mutex
+{
+	Mutex mutex;
+};
+
+typedef struct JobQueue
+{
+	void (*function)(void *user_data, size_t job);
+	void *user_data;
+	size_t total_jobs;
+	size_t next_job;
+} JobQueue;
+
+static Mutex global_mutex = MUTEX_INITIALISER;
+static Mutex queue_mutex = MUTEX_INITIALISER;
+
+static void DoJobs(JobQueue* const queue)
+{
+	for (;;)
+	{
+		size_t job;
+
+		LockMutex(&queue_mutex);
+		job = queue->next_job;
+
+		if (job != queue->total_jobs)
+			++queue->next_job;
+		UnlockMutex(&queue_mutex);
+
+		if (job == queue->total_jobs)
+			break;
+
+		queue->function(queue->user_data, job);
+	}
+}
+
+struct Thread_Pipeline
+{
+	void (*function)(void *user_data, void *job);
+	void *user_data;
+
+	/* Guards everything below. */
+	Mutex mutex;
+	/* Signalled when a job is added, or when no more jobs will be. */
+	Condition condition;
+
+	void **jobs;
+	size_t total_jobs, jobs_capacity, next_job;
+	int finished;
+
+	Thread *threads;
+	size_t total_threads;
+};
+
+static void DoPipelineJobs(Thread_Pipeline* const pipeline)
+{
+	for (;;)
+	{
+		void *job;
+
+		LockMutex(&pipeline->mutex);
+
+		while (pipeline->next_job == pipeline->total_jobs && !pipeline->finished)
+			WaitCondition(&pipeline->condition, &pipeline->mutex);
+
+		if (pipeline->next_job == pipeline->total_jobs)
+		{
+			UnlockMutex(&pipeline->mutex);
+			break;
+		}
+
+		job = pipeline->jobs[pipeline->next_job++];
+
+		UnlockMutex(&pipeline->mutex);
+
+		pipeline->function(pipeline->user_data, job);
+	}
+}
+
+#if defined(_WIN32)
+
+size_t Thread_GetTotalProcessors(void)
+{
+	SYSTEM_INFO system_info;
+
+	GetSystemInfo(&system_info);
+
+	return system_info.dwNumberOfProcessors;
+}
+
+static DWORD WINAPI ThreadEntry(LPVOID const parameter)
+{
+	DoJobs((JobQueue*)parameter);
+	return 0;
+}
+
+static int CreateThreadForQueue(Thread* const thread, JobQueue* const queue)
+{
+	*thread = CreateThread(NULL, 0, ThreadEntry, queue, 0, NULL);
+	return *thread != NULL;
+}
+
+static DWORD WINAPI PipelineThreadEntry(LPVOID const parameter)
+{
+	DoPipelineJobs((Thread_Pipeline*)parameter);
+	return 0;
+}
+
+static int CreateThreadForPipeline(Thread* const thread, Thread_Pipeline* const pipeline)
+{
+	*thread = CreateThread(NULL, 0, PipelineThreadEntry, pipeline, 0, NULL);
+	return *thread != NULL;
+}
+
+static void JoinThread(const Thread thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+#else
+
+size_t Thread_GetTotalProcessors(void)
+{
+	const long total_processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return total_processors < 1 ? 1 : total_processors;
+}
+
+static void* ThreadEntry(void* const parameter)
+{
+	DoJobs((JobQueue*)parameter);
+	return NULL;
+}
+
+static int CreateThreadForQueue(Thread* const thread, JobQueue* const queue)
+{
+	return pthread_create(thread, NULL, ThreadEntry, queue) == 0;
+}
+
+static void* PipelineThreadEntry(void* const parameter)
+{
+	DoPipelineJobs((Thread_Pipeline*)parameter);
+	return NULL;
+}
+
+static int CreateThreadForPipeline(Thread* const thread, Thread_Pipeline* const pipeline)
+{
+	return pthread_create(thread, NULL, PipelineThreadEntry, pipeline) == 0;
+}
+
+static void JoinThread(const Thread thread)
+{
+	pthread_join(thread, NULL);
+}
+
+#endif
+
+void Thread_RunJobs(void (* const function)(void *user_data, size_t job), void* const user_data, const size_t total_jobs)
+{
+	/* The calling thread does jobs too, so it counts as one of the threads. */
+	const size_t total_processors = Thread_GetTotalProcessors();
+	const size_t total_threads = total_jobs < total_processors ? total_jobs : total_processors;
+	const size_t total_extra_threads = total_threads == 0 ? 0 : total_threads - 1;
+	/* With only one thread, the calling thread does every job by itself. */
+	Thread* const threads = total_extra_threads == 0 ? NULL : (Thread*)malloc(sizeof(Thread) * total_extra_threads);
+
+	JobQueue queue;
+	size_t total_created_threads;
+	size_t i;
+
+	queue.function = function;
+	queue.user_data = user_data;
+	queue.total_jobs = total_jobs;
+	queue.next_job = 0;
+
+	/* If we lack the memory or the threads, then just do fewer jobs at once. */
+	total_created_threads = 0;
+
+	if (threads != NULL)
+		while (total_created_threads < total_extra_threads && CreateThreadForQueue(&threads[total_created_threads], &queue))
+			++total_created_threads;
+
+	DoJobs(&queue);
+
+	for (i = 0; i < total_created_threads; ++i)
+		JoinThread(threads[i]);
+
+	free(threads);
+}
+
+struct Thread_Jobs
+{
+	JobQueue queue;
+	Thread *threads;
+	size_t total_threads;
+};
+
+Thread_Jobs* Thread_StartJobs(void (* const function)(void *user_data, size_t job), void* const user_data, const size_t total_jobs, const size_t maximum_threads)
+{
+	/* Unlike 'Thread_RunJobs', the calling thread is busy with other things, so it does not count as one of the threads. */
+	const size_t total_processors = maximum_threads != 0 ? maximum_threads : Thread_GetTotalProcessors();
+	const size_t total_threads = total_jobs < total_processors ? total_jobs : total_processors;
+	Thread_Jobs *jobs;
+
+	/* There is nothing to do in the background, so there is nothing to wait for either. */
+	if (total_jobs == 0)
+		return NULL;
+
+	jobs = (Thread_Jobs*)malloc(sizeof(Thread_Jobs));
+
+	if (jobs == NULL)
+	{
+		Thread_RunJobs(function, user_data, total_jobs);
+	}
+	else
+	{
+		jobs->queue.function = function;
+		jobs->queue.user_data = user_data;
+		jobs->queue.total_jobs = total_jobs;
+		jobs->queue.next_job = 0;
+		jobs->threads = (Thread*)malloc(sizeof(Thread) * total_threads);
+		jobs->total_threads = 0;
+
+		/* If we lack the memory or the threads, then the jobs are done when they are waited for. */
+		if (jobs->threads != NULL)
+			while (jobs->total_threads < total_threads && CreateThreadForQueue(&jobs->threads[jobs->total_threads], &jobs->queue))
+				++jobs->total_threads;
+	}
+
+	return jobs;
+}
+
+void Thread_WaitJobs(Thread_Jobs* const jobs)
+{
+	size_t i;
+
+	if (jobs == NULL)
+		return;
+
+	DoJobs(&jobs->queue);
+
+	for (i = 0; i < jobs->total_threads; ++i)
+		JoinThread(jobs->threads[i]);
+
+	free(jobs->threads);
+	free(jobs);
+}
+
+Thread_Pipeline* Thread_StartPipeline(void (* const function)(void *user_data, void *job), void* const user_data, const size_t maximum_threads)
+{
+	/* The calling thread is busy adding jobs, so it does not count as one of the threads. */
+	const size_t total_threads = maximum_threads != 0 ? maximum_threads : Thread_GetTotalProcessors();
+	Thread_Pipeline* const pipeline = (Thread_Pipeline*)malloc(sizeof(Thread_Pipeline));
+
+	if (pipeline != NULL)
+	{
+		pipeline->function = function;
+		pipeline->user_data = user_data;
+		pipeline->jobs = NULL;
+		pipeline->total_jobs = pipeline->jobs_capacity = pipeline->next_job = 0;
+		pipeline->finished = 0;
+		pipeline->threads = (Thread*)malloc(sizeof(Thread) * total_threads);
+		pipeline->total_threads = 0;
+
+		/* If we lack the memory or the threads, then the jobs are just done as they are added. */
+		if (pipeline->threads != NULL && InitialiseMutex(&pipeline->mutex))
+		{
+			if (InitialiseCondition(&pipeline->condition))
+			{
+				while (pipeline->total_threads < total_threads && CreateThreadForPipeline(&pipeline->threads[pipeline->total_threads], pipeline))
+					++pipeline->total_threads;
+
+				if (pipeline->total_threads == 0)
+					DeinitialiseCondition(&pipeline->condition);
+			}
+
+			if (pipeline->total_threads == 0)
+				DeinitialiseMutex(&pipeline->mutex);
+		}
+	}
+
+	return pipeline;
+}
+
+void Thread_AddJob(Thread_Pipeline* const pipeline, void* const job)
+{
+	if (pipeline->total_threads != 0)
+	{
+		LockMutex(&pipeline->mutex);
+
+		if (pipeline->total_jobs == pipeline->jobs_capacity)
+		{
+			const size_t new_capacity = pipeline->jobs_capacity == 0 ? 0x10 : pipeline->jobs_capacity * 2;
+			void** const new_jobs = (void**)realloc(pipeline->jobs, sizeof(void*) * new_capacity);
+
+			if (new_jobs != NULL)
+			{
+				pipeline->jobs = new_jobs;
+				pipeline->jobs_capacity = new_capacity;
+			}
+		}
+
+		if (pipeline->total_jobs != pipeline->jobs_capacity)
+		{
+			pipeline->jobs[pipeline->total_jobs++] = job;
+			SignalCondition(&pipeline->condition);
+			UnlockMutex(&pipeline->mutex);
+			return;
+		}
+
+		UnlockMutex(&pipeline->mutex);
+	}
+
+	/* If there is nowhere to put the job, then just do it now. */
+	pipeline->function(pipeline->user_data, job);
+}
+
+void Thread_FinishPipeline(Thread_Pipeline* const pipeline)
+{
+	size_t i;
+
+	if (pipeline->total_threads != 0)
+	{
+		LockMutex(&pipeline->mutex);
+		pipeline->finished = 1;
+		BroadcastCondition(&pipeline->condition);
+		UnlockMutex(&pipeline->mutex);
+
+		/* Help with whatever jobs are left. */
+		DoPipelineJobs(pipeline);
+
+		for (i = 0; i < pipeline->total_threads; ++i)
+			JoinThread(pipeline->threads[i]);
+
+		DeinitialiseCondition(&pipeline->condition);
+		DeinitialiseMutex(&pipeline->mutex);
+	}
+
+	free(pipeline->jobs);
+	free(pipeline->threads);
+	free(pipeline);
+}
+
+Thread_Mutex* Thread_CreateMutex(void)
+{
+	Thread_Mutex *mutex = (Thread_Mutex*)malloc(sizeof(Thread_Mutex));
+
+	if (mutex != NULL && !InitialiseMutex(&mutex->mutex))
+	{
+		free(mutex);
+		mutex = NULL;
+	}
+
+	return mutex;
+}
+
+void Thread_DestroyMutex(Thread_Mutex* const mutex)
+{
+	DeinitialiseMutex(&mutex->mutex);
+	free(mutex);
+}
+
+void Thread_LockMutex(Thread_Mutex* const mutex)
+{
+	LockMutex(&mutex->mutex);
+}
+
+void Thread_UnlockMutex(Thread_Mutex* const mutex)
+{
+	UnlockMutex(&mutex->mutex);
+}
+
+void Thread_Lock(void)
+{
+	LockMutex(&global_mutex);
+}
+
+void Thread_Unlock(void)
+{
+	UnlockMutex(&global_mutex);
+}
+
+#else
+
+size_t Thread_GetTotalProcessors(void)
+{
+	return 1;
+}
+
+void Thread_RunJobs(void (* const function)(void *user_data, size_t job), void* const user_data, const size_t total_jobs)
+{
+	size_t i;
+
+	for (i = 0; i < total_jobs; ++i)
+		function(user_data, i);
+}
+
+Thread_Jobs* Thread_StartJobs(void (* const function)(void *user_data, size_t job), void* const user_data, const size_t total_jobs, const size_t maximum_threads)
+{
+	(void)maximum_threads;
+
+	Thread_RunJobs(function, user_data, total_jobs);
+	return NULL;
+}
+
+void Thread_WaitJobs(Thread_Jobs* const jobs)
+{
+	(void)jobs;
+}
+
+struct Thread_Pipeline
+{
+	void (*function)(void *user_data, void *job);
+	void *user_data;
+};
+
+Thread_Pipeline* Thread_StartPipeline(void (* const function)(void *user_data, void *job), void* const user_data, const size_t maximum_threads)
+{
+	Thread_Pipeline* const pipeline = (Thread_Pipeline*)malloc(sizeof(Thread_Pipeline));
+
+	(void)maximum_threads;
+
+	if (pipeline != NULL)
+	{
+		pipeline->function = function;
+		pipeline->user_data = user_data;
+	}
+
+	return pipeline;
+}
+
+void Thread_AddJob(Thread_Pipeline* const pipeline, void* const job)
+{
+	pipeline->function(pipeline->user_data, job);
+}
+
+void Thread_FinishPipeline(Thread_Pipeline* const pipeline)
+{
+	free(pipeline);
+}
+
+struct Thread_Mutex
+{
+	char dummy;
+};
+
+Thread_Mutex* Thread_CreateMutex(void)
+{
+	return (Thread_Mutex*)malloc(sizeof(Thread_Mutex));
+}
+
+void Thread_DestroyMutex(Thread_Mutex* const mutex)
+{
+	free(mutex);
+}
+
+void Thread_LockMutex(Thread_Mutex* const mutex)
+{
+	(void)mutex;
+}
+
+void Thread_UnlockMutex(Thread_Mutex* const mutex)
+{
+	(void)mutex;
+}
+
+void Thread_Lock(void)
+{
+
+}
+
+void Thread_Unlock(void)
+{
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* A tiny wrapper around the platform's threading API. If no threading API is
+   available, then everything is simply done on the calling thread. */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stddef.h>
+
+/* Returns the number of processors that the machine has, or 1 if threads
+   are not available. */
+size_t Thread_GetTotalProcessors(void);
+
+/* Calls 'function' once for every job in the range [0, total_jobs), spreading
+   the jobs across as many threads as the machine has processors. This does
+   not return until every job has been completed. */
+void Thread_RunJobs(void (*function)(void *user_data, size_t job), void *user_data, size_t total_jobs);
+
+typedef struct Thread_Jobs Thread_Jobs;
+
+/* Like 'Thread_RunJobs', but returns straight away, leaving the jobs to be
+   done in the background. 'Thread_WaitJobs' must be called to wait for them
+   to finish, and the calling thread helps with the remaining jobs while it
+   waits. If the jobs cannot be done in the background, then they are done
+   before this returns. At most 'maximum_threads' threads are started, or one
+   per processor if it is 0. */
+Thread_Jobs* Thread_StartJobs(void (*function)(void *user_data, size_t job), void *user_data, size_t total_jobs, size_t maximum_threads);
+void Thread_WaitJobs(Thread_Jobs *jobs);
+
+typedef struct Thread_Pipeline Thread_Pipeline;
+
+/* Starts threads that call 'function' for each job that is given to
+   'Thread_AddJob', in the order that they are added, so that jobs can be
+   started before all of them are known. 'Thread_FinishPipeline' waits for
+   every job to be done, and then frees the pipeline. If the jobs cannot be
+   done in the background, then they are done as they are added. At most
+   'maximum_threads' threads are started, or one per processor if it is 0.
+   Returns NULL on failure. */
+Thread_Pipeline* Thread_StartPipeline(void (*function)(void *user_data, void *job), void *user_data, size_t maximum_threads);
+void Thread_AddJob(Thread_Pipeline *pipeline, void *job);
+void Thread_FinishPipeline(Thread_Pipeline *pipeline);
+
+typedef struct Thread_Mutex Thread_Mutex;
+
+/* Returns NULL on failure. A mutex must be unlocked by the same thread that locked it. */
+Thread_Mutex* Thread_CreateMutex(void);
+void Thread_DestroyMutex(Thread_Mutex *mutex);
+void Thread_LockMutex(Thread_Mutex *mutex);
+void Thread_UnlockMutex(Thread_Mutex *mutex);
+
+/* A single process-wide lock, for guarding code which is not thread-safe. */
+void Thread_Lock(void);
+void Thread_Unlock(void);
+
+#endif /* THREAD_H */
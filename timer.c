@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* P2BIN_PTHREADS is only defined on POSIX platforms. */
+#if !defined(_WIN32) && defined(P2BIN_PTHREADS)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "timer.h"
+
+#if defined(_WIN32)
+
+#include <windows.h>
+
+double Timer_GetSeconds(void)
+{
+	LARGE_INTEGER frequency, counter;
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+void Timer_Sleep(const unsigned int milliseconds)
+{
+	Sleep(milliseconds);
+}
+
+#elif defined(P2BIN_PTHREADS)
+
+#include <time.h>
+
+double Timer_GetSeconds(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (double)time.tv_sec + (double)time.tv_nsec / 1000000000.0;
+}
+
+void Timer_Sleep(const unsigned int milliseconds)
+{
+	struct timespec time;
+
+	time.tv_sec = milliseconds / 1000;
+	time.tv_nsec = (long)(milliseconds % 1000) * 1000000;
+
+	/* Keep sleeping if a signal interrupts us. */
+	while (nanosleep(&time, &time) != 0);
+}
+
+#else
+
+#include <time.h>
+
+double Timer_GetSeconds(void)
+{
+	/* ANSI C has no wall-clock timer with a useful resolution. */
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+void Timer_Sleep(const unsigned int milliseconds)
+{
+	const double end_time = Timer_GetSeconds() + milliseconds / 1000.0;
+
+	while (Timer_GetSeconds() < end_time);
+}
+
+#endif
@@ -0,0 +1,28 @@
+/*
+Copyright (c) 2023 Clownacy
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/* Returns the current wall-clock time in seconds, relative to an arbitrary
+   point. Only the difference between two calls is meaningful. If the
+   platform has no suitable clock, then processor time is used instead. */
+double Timer_GetSeconds(void);
+
+/* Waits for roughly the given number of milliseconds. If the platform has no
+   way to sleep, then this busy-waits instead. */
+void Timer_Sleep(unsigned int milliseconds);
+
+#endif /* TIMER_H */